@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <resynth.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// for command-line argument parsing
+#include "kyaa.h"
+#include "kyaa_extra.h"
+
+// only used for the optional error maps.
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_STATIC
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-prototypes"
+#include "stb_image_write.h"
+#pragma GCC diagnostic pop
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *manipulate_filename(const char *fn,
+                                 const char *new_extension) {
+#define MAX_LENGTH 256
+    int length = strlen(fn);
+    if (length > MAX_LENGTH) length = MAX_LENGTH;
+    // out_fn must be freed by the caller.
+    char *out_fn = (char *)calloc(2 * MAX_LENGTH, 1);
+    strncpy(out_fn, fn, length);
+
+    char *hint = strrchr(out_fn, '.');
+    if (hint == NULL) strcpy(out_fn + length, new_extension);
+    else strcpy(hint, new_extension);
+
+    return out_fn;
+#undef MAX_LENGTH
+}
+
+static bool write_error_map(const char *fn, const float *map,
+                            size_t width, size_t height) {
+    // energies are mostly tiny, so stretch them out a bit to be visible.
+    uint8_t *pixels = malloc(width * height);
+    for (size_t i = 0; i < width * height; i++) {
+        double value = map[i] * 4.0;
+        pixels[i] = (uint8_t)(255.0 * (value > 1.0 ? 1.0 : value));
+    }
+    int result = stbi_write_png(fn, width, height, 1, pixels, 0);
+    free(pixels);
+    return result != 0;
+}
+
+// hardware counters are read around every phase the library reports,
+// on whichever thread runs it, and summed per kind of phase
+// (numbers are stripped from names, so every pass adds up to "pass").
+#define COUNTERS 6
+#define MAX_PHASES 32
+#define MAX_DEPTH 16
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} counter_events[COUNTERS] = {
+#ifdef __linux__
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"L1d", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+        PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    {"LLC", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"dTLB", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+        PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+#endif
+};
+
+typedef struct {
+    char name[32];
+    long calls;
+    uint64_t values[COUNTERS];
+} Phase_counts;
+
+static struct {
+    pthread_mutex_t lock;
+    bool available[COUNTERS];
+    Phase_counts phases[MAX_PHASES];
+    int phase_count;
+} counters = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static _Thread_local struct {
+    bool opened;
+    int fds[COUNTERS];
+    uint64_t begun[MAX_DEPTH][COUNTERS];
+    int depth;
+} thread_counters;
+
+static int counter_open(int index) {
+    // counts the calling thread, in user space only, which is allowed
+    // with the default perf_event_paranoid setting.
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter_events[index].type;
+    attr.config = counter_events[index].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // there may be more counters than the hardware has, in which case the
+    // kernel takes turns between them; the times tell how long each counted.
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void)index;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void counters_read(uint64_t *values) {
+    if (!thread_counters.opened) {
+        for (int i = 0; i < COUNTERS; i++) {
+            thread_counters.fds[i] = counters.available[i] ? counter_open(i) : -1;
+        }
+        thread_counters.opened = true;
+    }
+    for (int i = 0; i < COUNTERS; i++) {
+        // value, time enabled, time running, as asked for in counter_open.
+        // a counter that only ran part of the time is scaled up to all of it.
+        const int fd = thread_counters.fds[i];
+        uint64_t read_values[3];
+        if (fd < 0 || read(fd, read_values, sizeof(read_values)) != sizeof(read_values) ||
+            read_values[2] == 0) {
+            values[i] = 0;
+        } else if (read_values[2] < read_values[1]) {
+            values[i] = (uint64_t)((double)read_values[0] * read_values[1] / read_values[2]);
+        } else {
+            values[i] = read_values[0];
+        }
+    }
+}
+
+static bool counters_probe(void) {
+    // finds out which counters can be read at all.
+    bool any = false;
+    int error = 0;
+    for (int i = 0; i < COUNTERS; i++) {
+        const int fd = counter_open(i);
+        if (fd < 0) error = errno;
+        else close(fd);
+        counters.available[i] = fd >= 0;
+        any |= fd >= 0;
+    }
+    if (!any) {
+        fprintf(stderr, "hardware counters are unavailable: %s%s\n",
+                strerror(error), error == EACCES || error == EPERM ?
+                " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+    }
+    return any;
+}
+
+static void counters_hook(void *user, const char *name, bool begin) {
+    (void)user;
+    if (begin) {
+        if (thread_counters.depth < MAX_DEPTH) {
+            counters_read(thread_counters.begun[thread_counters.depth]);
+        }
+        thread_counters.depth++;
+        return;
+    }
+    if (--thread_counters.depth >= MAX_DEPTH) return;
+    uint64_t values[COUNTERS];
+    counters_read(values);
+    const uint64_t *begun = thread_counters.begun[thread_counters.depth];
+
+    // "pass 12" counts as "pass".
+    char kind[sizeof(counters.phases[0].name)];
+    snprintf(kind, sizeof(kind), "%s", name);
+    for (int i = strlen(kind) - 1; i > 0 && (kind[i] == ' ' ||
+         (kind[i] >= '0' && kind[i] <= '9')); i--) kind[i] = '\0';
+
+    pthread_mutex_lock(&counters.lock);
+    int i = 0;
+    while (i < counters.phase_count && strcmp(counters.phases[i].name, kind)) i++;
+    if (i < MAX_PHASES) {
+        Phase_counts *phase = &counters.phases[i];
+        if (i == counters.phase_count) {
+            counters.phase_count++;
+            strcpy(phase->name, kind);
+        }
+        phase->calls++;
+        for (int j = 0; j < COUNTERS; j++) phase->values[j] += values[j] - begun[j];
+    }
+    pthread_mutex_unlock(&counters.lock);
+}
+
+static void counters_report(const char *fn, int repeats, size_t pixels) {
+    // per run: calls, cycles, IPC, and misses per output pixel.
+    printf("%s: counters per run; misses per output pixel\n", fn);
+    printf("  %-16s %6s %10s %6s", "phase", "calls", "Mcycles", "IPC");
+    for (int j = 2; j < COUNTERS; j++) printf(" %8s", counter_events[j].name);
+    printf("\n");
+    for (int i = 0; i < counters.phase_count; i++) {
+        const Phase_counts *phase = &counters.phases[i];
+        const double cycles = (double)phase->values[0];
+        printf("  %-16s %6.0f", phase->name, (double)phase->calls / repeats);
+        if (counters.available[0]) printf(" %10.2f", cycles / repeats * 1e-6);
+        else printf(" %10s", "n/a");
+        if (counters.available[0] && counters.available[1] && cycles > 0) {
+            printf(" %6.2f", phase->values[1] / cycles);
+        } else printf(" %6s", "n/a");
+        for (int j = 2; j < COUNTERS; j++) {
+            if (counters.available[j]) {
+                printf(" %8.3f", (double)phase->values[j] / repeats / pixels);
+            } else printf(" %8s", "n/a");
+        }
+        printf("\n");
+    }
+    counters.phase_count = 0;
+    memset(counters.phases, 0, sizeof(counters.phases));
+}
+
+static resynth_result_t time_runs(resynth_state_t state,
+                                  resynth_parameters_t params, int repeats,
+                                  double *fastest, double *total) {
+    resynth_result_t result = NULL;
+    *fastest = *total = 0;
+    for (int i = 0; i < repeats; i++) {
+        if (result != NULL) resynth_free_result(result);
+        const double start = monotonic_seconds();
+        resynth_phase("run", true);
+        result = resynth_run(state, params);
+        resynth_phase("run", false);
+        const double elapsed = monotonic_seconds() - start;
+        if (i == 0 || elapsed < *fastest) *fastest = elapsed;
+        *total += elapsed;
+    }
+    return result;
+}
+
+// runs the same synthesis a number of times per image and reports how long
+// it took alongside the energy of the output, so changes to speed and
+// quality can be judged together.
+int main(int argc, char** argv) {
+    int ret = 0;
+    int scale = 1;
+    double autism = 32. / 256.;
+    int neighbors = 29;
+    int tries = 192;
+    int magic = 192;
+    unsigned long seed = 1;
+    int tile_size = 0;
+    int threads = 0;
+    int patch_size = 0;
+    int polish_worst = 0;
+    bool adaptive_tries = false;
+    int sparse = 0;
+    int repeats = 3;
+    bool error_map = false;
+    bool generic = false;
+    bool compare = false;
+    int channels = 3;
+    bool hardware_counters = false;
+
+    KYAA_LOOP {
+        KYAA_BEGIN
+
+        KYAA_FLAG_LONG('a', "autism",
+"        sensitivity to outliers\n"
+"        range: [0,256];     default: 32")
+            autism = (double)(kyaa_long_value) / 256.;
+
+        KYAA_FLAG_LONG('N', "neighbors",
+"        points to use when sampling\n"
+"        range: [0,1024];    default: 29")
+            neighbors = kyaa_long_value;
+
+        KYAA_FLAG_LONG('M', "tries",
+"        random points added to candidates\n"
+"        range: [0,65536];   default: 192")
+            tries = kyaa_long_value;
+
+        KYAA_FLAG_LONG('m', "magic",
+"        magic constant, affects iterations\n"
+"        range: [0,255];     default: 192")
+            magic = kyaa_long_value;
+
+        KYAA_FLAG_LONG('s', "scale",
+"        output size multiplier; negative values set width and height\n"
+"        range: [-8192,32];  default: 1")
+            scale = kyaa_long_value;
+
+        KYAA_FLAG_LONG('S', "seed",
+"        initial RNG value; every repeat uses the same one\n"
+"                            default: 1")
+            seed = (unsigned long) kyaa_long_value;
+
+        KYAA_FLAG_LONG('W', "polish-worst",
+"        after -m, polish the worst pixels in up to this many passes\n"
+"        range: [0,1024];    default: 0 [disabled]")
+            polish_worst = kyaa_long_value;
+
+        KYAA_FLAG_LONG('X', "sparse",
+"        keep the nearest half of -N, spread the rest this far apart;\n"
+"        the last pass is dense\n"
+"        range: [0,64];      default: 0 [dense]")
+            sparse = kyaa_long_value;
+
+        KYAA_FLAG('T', "adaptive-tries",
+"        skip most random tries where neighbors already suggest a good match")
+            adaptive_tries = true;
+
+        KYAA_FLAG_LONG('t', "tile-size",
+"        synthesize in parallel tiles of this size; 0 disables tiling\n"
+"        range: [0,65536];   default: 0")
+            tile_size = kyaa_long_value;
+
+        KYAA_FLAG_LONG('j', "threads",
+"        worker threads for tiled synthesis\n"
+"        range: [0,1024];    default: 0 [one per core]")
+            threads = kyaa_long_value;
+
+        KYAA_FLAG_LONG('p', "patch-size",
+"        quilt patches of this size instead of synthesizing per pixel\n"
+"        range: [0,1024];    default: 0 [per pixel]")
+            patch_size = kyaa_long_value;
+
+        KYAA_FLAG_LONG('r', "repeats",
+"        runs per image; the fastest one is reported\n"
+"        range: [1,1000];    default: 3")
+            repeats = kyaa_long_value;
+            if (repeats < 1) repeats = 1;
+
+        KYAA_FLAG_LONG('C', "channels",
+"        channels to load the image with; 4 includes alpha\n"
+"        range: [3,4];       default: 3")
+            channels = kyaa_long_value;
+
+        KYAA_FLAG('g', "generic",
+"        use the generic kernel instead of a specialized one")
+            generic = true;
+
+        KYAA_FLAG('k', "compare-kernels",
+"        also time the generic kernel and report the speedup")
+            compare = true;
+
+        KYAA_FLAG('e', "error-map",
+"        save each pixel's energy as {filename}.error.png")
+            error_map = true;
+
+        KYAA_FLAG('H', "hardware-counters",
+"        count cycles, instructions, and L1d, LLC, branch and dTLB misses\n"
+"        in each phase of the runs (Linux only)")
+            hardware_counters = counters_probe();
+
+        KYAA_HELP("  {files...}\n"
+"        image files to benchmark\n"
+"        required            default: [none]")
+
+        KYAA_END
+
+        if (kyaa_read_stdin) {
+            fprintf(stderr, "fatal error: reading from stdin is unsupported\n");
+            exit(1);
+        }
+
+        const char *fn = kyaa_arg;
+
+        resynth_state_t state = resynth_state_create_from_image(fn, channels, scale);
+        if (state == NULL) {
+            ret--;
+            continue;
+        }
+        resynth_parameters_t params = resynth_parameters_create();
+        resynth_parameters_outlier_sensitivity(params, autism);
+        resynth_parameters_neighbors(params, neighbors);
+        resynth_parameters_magic(params, magic);
+        resynth_parameters_tries(params, tries);
+        resynth_parameters_random_seed(params, seed);
+        resynth_parameters_tiles(params, tile_size, 8);
+        resynth_parameters_threads(params, threads);
+        resynth_parameters_generic_kernel(params, generic);
+        resynth_parameters_adaptive_tries(params, adaptive_tries);
+        if (sparse > 0) {
+            resynth_parameters_sparse(params, (neighbors + 1) / 2, sparse, 1);
+        }
+        if (polish_worst > 0) {
+            resynth_parameters_polish(params, RESYNTH_POLISH_WORST, 0, polish_worst);
+        }
+        if (patch_size > 0) {
+            resynth_parameters_engine(params, RESYNTH_ENGINE_QUILT);
+            resynth_parameters_patch(params, patch_size, 8);
+        }
+
+        double fastest, total;
+        if (hardware_counters) resynth_set_phase_hook(counters_hook, NULL);
+        resynth_result_t result = time_runs(state, params, repeats,
+                                            &fastest, &total);
+        if (hardware_counters) resynth_set_phase_hook(NULL, NULL);
+        const char *kernel = resynth_kernel_name(state, params);
+
+        const size_t width = resynth_result_width(result);
+        const size_t height = resynth_result_height(result);
+        float *map = error_map ? calloc(width * height, sizeof(float)) : NULL;
+        const double energy = resynth_result_measure(result, state, params, map);
+
+        printf("%s: %zux%zu, %s kernel, %d runs, fastest %.3f ms, "
+               "mean %.3f ms, %.3f us/px, energy %.6f\n",
+               fn, width, height, kernel, repeats, fastest * 1e3,
+               total / repeats * 1e3, fastest * 1e6 / (width * height),
+               energy);
+        if (hardware_counters) counters_report(fn, repeats, width * height);
+
+        if (compare && !generic) {
+            // the output is the same either way, so only the time matters.
+            double generic_fastest, generic_total;
+            resynth_parameters_generic_kernel(params, true);
+            resynth_free_result(time_runs(state, params, repeats,
+                                          &generic_fastest, &generic_total));
+            resynth_parameters_generic_kernel(params, false);
+            printf("%s: generic kernel, fastest %.3f ms; %s is %.2fx as fast\n",
+                   fn, generic_fastest * 1e3, kernel, generic_fastest / fastest);
+        }
+
+        if (map != NULL) {
+            char *map_fn = manipulate_filename(fn, ".error.png");
+            if (!write_error_map(map_fn, map, width, height)) {
+                fprintf(stderr, "failed to write: %s\n", map_fn);
+                ret--;
+            }
+            free(map_fn);
+            free(map);
+        }
+
+        resynth_free_result(result);
+        resynth_free_parameters(params);
+        resynth_free_state(state);
+    }
+
+    return ret;
+}
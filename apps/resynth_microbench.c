@@ -0,0 +1,223 @@
+// microbenchmarks of the hot paths in isolation, for judging changes
+// to a single kernel more precisely than resynth_bench can.
+// resynth.c is included directly, so its internals can be called.
+#include "resynth.c"
+
+// for command-line argument parsing
+#include "kyaa.h"
+#include "kyaa_extra.h"
+
+// every operation runs at least this long per sample, so timer resolution
+// and call overhead don't matter.
+#define SAMPLE_SECONDS 0.02
+#define TRY_BATCH 64
+#define MAX_FILTERS 64
+
+typedef struct {
+    Resynth_state *s;
+    Parameters parameters;
+    Coord *points; // candidates or positions, cycled through
+    int point_mask;
+    int next;
+} Fixture;
+
+typedef struct Case {
+    const char *name;
+    int channels, neighbors;
+    int corpus_size, data_size;
+    double fill; // the share of output pixels with a value
+    void (*run)(Fixture *f, long ops);
+} Case;
+
+static void run_try_point(Fixture *f, long ops);
+
+static void fill_noise(rnd_pcg_t *rng, Pixel *pixels, size_t count) {
+    for (size_t i = 0; i < count; i++) pixels[i] = rnd_pcg_next(rng) >> 24;
+}
+
+static void fixture_setup(Fixture *f, const Case *c) {
+    // a state with a noise corpus and a noise output, of which a share
+    // of pixels (fill) has a value, and a ring of random points:
+    // candidates in the corpus for try_point, positions in the output otherwise.
+    rnd_pcg_t rng;
+    rnd_pcg_seed(&rng, 1);
+    const size_t corpus_bytes = (size_t)c->corpus_size * c->corpus_size * c->channels;
+    Pixel *corpus = malloc(corpus_bytes);
+    fill_noise(&rng, corpus, corpus_bytes);
+
+    memset(f, 0, sizeof(*f));
+    f->s = resynth_state_create_from_memory(corpus, c->corpus_size,
+        c->corpus_size, c->channels, -c->data_size);
+    free(corpus);
+    Resynth_state *s = f->s;
+
+    resynth_parameters_t parameters = resynth_parameters_create();
+    f->parameters = *parameters;
+    f->parameters.neighbors = c->neighbors;
+    resynth_free_parameters(parameters);
+    resynth__tables(s, f->parameters);
+    resynth__work(s, f->parameters);
+
+    fill_noise(&rng, s->data_array,
+               (size_t)s->data.width * s->data.height * s->data.depth);
+    for (int i = 0; i < s->data.width * s->data.height; i++) {
+        s->status_array[i].has_value = rnd_pcg_nextf(&rng) < c->fill;
+    }
+
+    const int size = 1 << 16;
+    f->points = calloc(size, sizeof(Coord));
+    f->point_mask = size - 1;
+    const Image image = c->run == run_try_point ? s->corpus : s->data;
+    for (int i = 0; i < size; i++) {
+        f->points[i].x = rnd_pcg_range(&rng, 0, image.width - 1);
+        f->points[i].y = rnd_pcg_range(&rng, 0, image.height - 1);
+    }
+
+    // try_point compares candidates against the neighbors of a pixel
+    // in the middle of a full output.
+    const Coord middle = {s->data.width / 2, s->data.height / 2};
+    resynth__gather(s, f->parameters, middle, false);
+}
+
+static void fixture_free(Fixture *f) {
+    resynth_free_state(f->s);
+    free(f->points);
+}
+
+static void run_try_point(Fixture *f, long ops) {
+    // one op is one candidate, in batches like the synthesis loop's.
+    Resynth_state *s = f->s;
+    for (long i = 0; i < ops; i += TRY_BATCH) {
+        s->best = INT_MAX;
+        s->try_kernel(s, f->points + (f->next & f->point_mask), TRY_BATCH);
+        f->next += TRY_BATCH;
+    }
+}
+
+static void run_gather(Fixture *f, long ops) {
+    for (long i = 0; i < ops; i++) {
+        resynth__gather(f->s, f->parameters,
+                        f->points[f->next++ & f->point_mask], false);
+    }
+}
+
+static void run_offsets(Fixture *f, long ops) {
+    for (long i = 0; i < ops; i++) make_offset_list(f->s);
+}
+
+static void run_points(Fixture *f, long ops) {
+    // listing, shuffling and polishing setup, as for warm starts and tiles.
+    for (long i = 0; i < ops; i++) resynth__points(f->s, f->parameters);
+}
+
+static void run_order(Fixture *f, long ops) {
+    // the same, implicitly, as for fresh runs.
+    for (long i = 0; i < ops; i++) resynth__order(f->s, f->parameters);
+}
+
+static void run_work(Fixture *f, long ops) {
+    for (long i = 0; i < ops; i++) resynth__work(f->s, f->parameters);
+}
+
+// corpora of 64x64 stay in cache, while 2048x2048 ones don't.
+static const Case cases[] = {
+    {"try_point/c3n9/warm",    3,   9,   64,   64, 1, run_try_point},
+    {"try_point/c3n9/cold",    3,   9, 2048,   64, 1, run_try_point},
+    {"try_point/c3n29/warm",   3,  29,   64,   64, 1, run_try_point},
+    {"try_point/c3n29/cold",   3,  29, 2048,   64, 1, run_try_point},
+    {"try_point/c3n45/warm",   3,  45,   64,   64, 1, run_try_point},
+    {"try_point/c3n45/cold",   3,  45, 2048,   64, 1, run_try_point},
+    {"try_point/c4n29/warm",   4,  29,   64,   64, 1, run_try_point},
+    {"try_point/c4n29/cold",   4,  29, 2048,   64, 1, run_try_point},
+    {"try_point/c4n45/warm",   4,  45,   64,   64, 1, run_try_point},
+    {"try_point/c4n45/cold",   4,  45, 2048,   64, 1, run_try_point},
+    {"try_point/c3n113/warm",  3, 113,   64,   64, 1, run_try_point},
+    {"try_point/c3n113/cold",  3, 113, 2048,   64, 1, run_try_point},
+    {"gather/n29/fill10",      3,  29,  256,  256, 0.10, run_gather},
+    {"gather/n29/fill50",      3,  29,  256,  256, 0.50, run_gather},
+    {"gather/n29/fill100",     3,  29,  256,  256, 1, run_gather},
+    {"gather/n45/fill50",      3,  45,  256,  256, 0.50, run_gather},
+    {"offsets/64",             3,  29,   64,   64, 0, run_offsets},
+    {"offsets/256",            3,  29,  256,  256, 0, run_offsets},
+    {"init/work/1024",         3,  29,  256, 1024, 0, run_work},
+    {"init/points/256",        3,  29,  256,  256, 0, run_points},
+    {"init/points/1024",       3,  29,  256, 1024, 0, run_points},
+    {"init/order/1024",        3,  29,  256, 1024, 0, run_order},
+};
+
+static double time_ops(const Case *c, Fixture *f, long ops) {
+    const double start = monotonic_seconds();
+    c->run(f, ops);
+    return monotonic_seconds() - start;
+}
+
+static bool selected(const char *name, const char **filters, int count) {
+    if (count == 0) return true;
+    for (int i = 0; i < count; i++) {
+        if (strstr(name, filters[i])) return true;
+    }
+    return false;
+}
+
+static void run_case(const Case *c, int samples) {
+    Fixture f;
+    fixture_setup(&f, c);
+
+    // find how many ops fill a sample, which also warms things up.
+    long ops = c->run == run_try_point ? TRY_BATCH : 1;
+    while (time_ops(c, &f, ops) < SAMPLE_SECONDS) ops *= 2;
+
+    double sum = 0, sum2 = 0, fastest = 0;
+    for (int i = 0; i < samples; i++) {
+        const double ns = time_ops(c, &f, ops) * 1e9 / ops;
+        sum += ns;
+        sum2 += ns * ns;
+        if (i == 0 || ns < fastest) fastest = ns;
+    }
+    const double mean = sum / samples;
+    const double deviation = sqrt(MAX(sum2 / samples - mean * mean, 0));
+    printf("%-24s %12.2f ns/op  +- %5.1f%%  fastest %12.2f  (%d x %ld ops)\n",
+           c->name, mean, 100 * deviation / mean, fastest, samples, ops);
+    fflush(stdout);
+    fixture_free(&f);
+}
+
+int main(int argc, char** argv) {
+    int samples = 10;
+    bool list = false;
+    const char *filters[MAX_FILTERS];
+    int filter_count = 0;
+
+    KYAA_LOOP {
+        KYAA_BEGIN
+
+        KYAA_FLAG_LONG('r', "samples",
+"        timed samples per case, for the mean and deviation\n"
+"        range: [2,1000];    default: 10")
+            samples = CLAMPV(kyaa_long_value, 2, 1000);
+
+        KYAA_FLAG('l', "list",
+"        list the cases instead of running them")
+            list = true;
+
+        KYAA_HELP("  {filters...}\n"
+"        only run cases whose names contain one of these, e.g. try_point/c3\n"
+"        optional            default: [every case]")
+
+        KYAA_END
+
+        if (kyaa_read_stdin) {
+            fprintf(stderr, "fatal error: reading from stdin is unsupported\n");
+            exit(1);
+        }
+
+        if (filter_count < MAX_FILTERS) filters[filter_count++] = kyaa_arg;
+    }
+
+    for (int i = 0; i < (int)LEN(cases); i++) {
+        if (!selected(cases[i].name, filters, filter_count)) continue;
+        if (list) puts(cases[i].name);
+        else run_case(&cases[i], samples);
+    }
+    return 0;
+}
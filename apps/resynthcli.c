@@ -2,6 +2,15 @@
 #include <stdbool.h>
 #include <string.h>
 #include <limits.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <resynth.h>
 
 // for command-line argument parsing
@@ -35,15 +44,469 @@ static char *manipulate_filename(const char *fn,
 #undef MAX_LENGTH
 }
 
+// the settings of a single run, from the command line or a streamed frame.
+typedef struct {
+    double autism;
+    int neighbors, tries, magic;
+    int scale;
+    unsigned long seed;
+    bool seed_given;
+    int tile_size, tile_overlap, threads;
+    int patch_size, patch_overlap;
+    int polish_worst;
+    bool adaptive_tries;
+    int sparse;
+    int wang_size;
+    int deadline;
+    int shards;
+} Options;
+
+static const Options default_options = {
+    .autism = 32. / 256.,
+    .neighbors = 29,
+    .tries = 192,
+    .magic = 192,
+    .scale = 1,
+    .tile_overlap = 8,
+    .patch_overlap = 8,
+};
+
+static resynth_parameters_t options_parameters(const Options *o) {
+    resynth_parameters_t params = resynth_parameters_create();
+    resynth_parameters_outlier_sensitivity(params, o->autism);
+    resynth_parameters_neighbors(params, o->neighbors);
+    resynth_parameters_magic(params, o->magic);
+    resynth_parameters_tries(params, o->tries);
+    resynth_parameters_random_seed(params, o->seed);
+    resynth_parameters_tiles(params, o->tile_size, o->tile_overlap);
+    resynth_parameters_threads(params, o->threads);
+    resynth_parameters_adaptive_tries(params, o->adaptive_tries);
+    if (o->sparse > 0) {
+        resynth_parameters_sparse(params, (o->neighbors + 1) / 2, o->sparse, 1);
+    }
+    if (o->polish_worst > 0) {
+        resynth_parameters_polish(params, RESYNTH_POLISH_WORST, 0, o->polish_worst);
+    }
+    if (o->patch_size > 0) {
+        resynth_parameters_engine(params, RESYNTH_ENGINE_QUILT);
+        resynth_parameters_patch(params, o->patch_size, o->patch_overlap);
+    }
+    return params;
+}
+
+// with -J, the tiles of a tiled run (-t) are synthesized by forked worker
+// processes, into memory shared with this one, which then fills in the seams.
+// workers take tiles one at a time from a shared counter and mark them done,
+// so the tiles of any worker that crashes are redone here afterwards.
+typedef struct {
+    atomic_int next;
+    atomic_uchar *done;
+    uint8_t *pixels;
+    int32_t *sources;
+} Shards;
+
+static void shard_work(resynth_state_t state, resynth_parameters_t params,
+                       Shards *shards, int count) {
+    // runs in the workers, which have a core each.
+    resynth_parameters_threads(params, 1);
+    for (;;) {
+        const int index = atomic_fetch_add(&shards->next, 1);
+        if (index >= count) break;
+        if (!resynth_tile_run(state, params, index, shards->pixels, shards->sources)) break;
+        atomic_store(&shards->done[index], 1);
+    }
+}
+
+static resynth_result_t shard_run(resynth_state_t state,
+                                  resynth_parameters_t params, int workers) {
+    const int count = (int)resynth_tile_count(state, params);
+    const size_t area = resynth_state_width(state) * resynth_state_height(state);
+    const size_t size = sizeof(Shards) + count +
+                        2 * area * sizeof(int32_t) +
+                        area * resynth_state_channels(state);
+    void *shared = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) return resynth_run(state, params);
+
+    // (mmap returns zeroed memory, so no tile is taken or done yet)
+    Shards *shards = (Shards *)shared;
+    shards->sources = (int32_t *)(shards + 1);
+    shards->pixels = (uint8_t *)(shards->sources + 2 * area);
+    shards->done = (atomic_uchar *)(shards->pixels +
+                                    area * resynth_state_channels(state));
+    atomic_init(&shards->next, 0);
+
+    fflush(stdout);
+    pid_t *pids = (pid_t *)calloc(workers, sizeof(pid_t));
+    for (int i = 0; i < workers; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            shard_work(state, params, shards, count);
+            _exit(0);
+        }
+    }
+    for (int i = 0; i < workers; i++) {
+        int status = 0;
+        if (pids[i] < 0) {
+            fprintf(stderr, "failed to start shard %d\n", i);
+        } else if (waitpid(pids[i], &status, 0) < 0 ||
+                   !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "shard %d failed; redoing its tiles\n", i);
+        }
+    }
+    free(pids);
+
+    for (int i = 0; i < count; i++) {
+        if (atomic_load(&shards->done[i])) continue;
+        resynth_tile_run(state, params, i, shards->pixels, shards->sources);
+    }
+    resynth_result_t result = resynth_tile_seams(state, params, shards->pixels,
+                                                 shards->sources);
+    munmap(shared, size);
+    return result;
+}
+
+static resynth_result_t options_run(resynth_state_t state,
+                                    resynth_parameters_t params,
+                                    const Options *o) {
+    // returns NULL if the Wang tiles can't be made.
+    if (o->wang_size > 0) {
+        resynth_wang_t wang = resynth_wang_create(state, params, o->wang_size, 2);
+        if (wang == NULL) return NULL;
+        resynth_result_t result = resynth_wang_assemble(wang, 0, 0, o->seed);
+        resynth_free_wang(wang);
+        return result;
+    }
+    if (o->deadline > 0) {
+        return resynth_run_anytime(state, params, o->deadline / 1000., NULL, NULL);
+    }
+    if (o->shards > 0 && resynth_tile_count(state, params) > 0) {
+        return shard_run(state, params, o->shards);
+    }
+    return resynth_run(state, params);
+}
+
+// with - as a filename, frames are read from stdin until it ends. each is
+// a line of text, followed by as many bytes of the image as it says:
+//   raw {width} {height} {channels} [flags...]   pixels (3 or 4 channels)
+//   encoded {size} [flags...]                    a png, jpeg, bmp or gif
+// the flags are those of a single run (-a -N -M -m -s -S -W -X -T -t -o -j
+// -J -p -P -w -d), on top of the ones given before the -. each result is written
+// to stdout the same way, encoded ones as png, or as "error {message}".
+// the buffers are kept from frame to frame.
+#define FRAME_LINE 4096
+
+typedef struct {
+    uint8_t *input, *output;
+    size_t input_capacity, output_size, output_capacity;
+} Stream;
+
+static bool reserve(uint8_t **buffer, size_t *capacity, size_t size) {
+    if (size <= *capacity) return true;
+    size_t grown = *capacity ? *capacity : 65536;
+    while (grown < size) grown *= 2;
+    uint8_t *bigger = (uint8_t *)realloc(*buffer, grown);
+    if (bigger == NULL) return false;
+    *buffer = bigger;
+    *capacity = grown;
+    return true;
+}
+
+static void stream_write(void *context, void *data, int size) {
+    Stream *stream = (Stream *)context;
+    if (!reserve(&stream->output, &stream->output_capacity,
+                 stream->output_size + size)) return;
+    memcpy(stream->output + stream->output_size, data, size);
+    stream->output_size += size;
+}
+
+static const char *frame_number(long *value, long low, long high) {
+    const char *token = strtok(NULL, " \t\r\n");
+    if (token == NULL) return "expected a number";
+    const char *err = kyaa_str_to_long(token, value);
+    if (err != NULL) return err;
+    if (*value < low || *value > high) return "number out of range";
+    return NULL;
+}
+
+static const char *frame_options(Options *o) {
+    const char *token;
+    while ((token = strtok(NULL, " \t\r\n")) != NULL) {
+        if (token[0] != '-' || token[1] == '\0' || token[2] != '\0') {
+            return "expected a flag";
+        }
+        if (token[1] == 'T') {
+            o->adaptive_tries = true;
+            continue;
+        }
+        long value;
+        const char *err = frame_number(&value, LONG_MIN, LONG_MAX);
+        if (err != NULL) return err;
+        switch (token[1]) {
+        case 'a': o->autism = (double)value / 256.; break;
+        case 'N': o->neighbors = value; break;
+        case 'M': o->tries = value; break;
+        case 'm': o->magic = value; break;
+        case 's': o->scale = value; break;
+        case 'S': o->seed = (unsigned long)value; o->seed_given = true; break;
+        case 'W': o->polish_worst = value; break;
+        case 'X': o->sparse = value; break;
+        case 't': o->tile_size = value; break;
+        case 'o': o->tile_overlap = value; break;
+        case 'j': o->threads = value; break;
+        case 'p': o->patch_size = value; break;
+        case 'P': o->patch_overlap = value; break;
+        case 'w': o->wang_size = value; break;
+        case 'd': o->deadline = value; break;
+        case 'J': o->shards = value; break;
+        default: return "unknown flag";
+        }
+    }
+    return NULL;
+}
+
+static int stream_frames(const Options *defaults) {
+    Stream stream = {0};
+    char line[FRAME_LINE];
+    int ret = 0;
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        // past a frame that can't be read, there's no telling
+        // where the next one begins, so that ends the stream.
+        if (strchr(line, '\n') == NULL && !feof(stdin)) {
+            printf("error frame line too long\n");
+            ret = 1;
+            break;
+        }
+        const char *kind = strtok(line, " \t\r\n");
+        if (kind == NULL) continue;
+        const bool raw = strcmp(kind, "raw") == 0;
+        long width = 0, height = 0, channels = 3, size = 0;
+        const char *err = NULL;
+        if (raw) {
+            if (err == NULL) err = frame_number(&width, 1, 65536);
+            if (err == NULL) err = frame_number(&height, 1, 65536);
+            if (err == NULL) err = frame_number(&channels, 1, 4);
+            size = width * height * channels;
+        } else if (strcmp(kind, "encoded") == 0) {
+            err = frame_number(&size, 1, INT_MAX);
+        } else {
+            err = "expected raw or encoded";
+        }
+        if (err == NULL && !reserve(&stream.input, &stream.input_capacity, size)) {
+            err = "out of memory";
+        }
+        if (err == NULL &&
+            fread(stream.input, 1, size, stdin) != (size_t)size) {
+            err = "truncated frame";
+        }
+        if (err != NULL) {
+            printf("error %s\n", err);
+            ret = 1;
+            break;
+        }
+
+        resynth_phase("frame", true);
+        Options o = *defaults;
+        err = frame_options(&o);
+        if (err == NULL && channels < 3) err = "only 3 or 4 channels are supported";
+        resynth_state_t state = NULL;
+        if (err == NULL) {
+            state = raw ? resynth_state_create_from_memory(stream.input,
+                              width, height, channels, o.scale)
+                        : resynth_state_create_from_encoded(stream.input,
+                              size, 3, o.scale);
+            if (state == NULL) err = "invalid image";
+        }
+        resynth_result_t result = NULL;
+        resynth_parameters_t params = NULL;
+        if (err == NULL) {
+            params = options_parameters(&o);
+            result = options_run(state, params, &o);
+            if (result == NULL) err = "no result";
+        }
+
+        if (err == NULL && raw) {
+            const size_t w = resynth_result_width(result);
+            const size_t h = resynth_result_height(result);
+            const size_t c = resynth_result_channels(result);
+            printf("raw %zu %zu %zu\n", w, h, c);
+            fwrite(resynth_result_pixels(result), 1, w * h * c, stdout);
+        } else if (err == NULL) {
+            resynth_phase("encode", true);
+            stream.output_size = 0;
+            const int written = stbi_write_png_to_func(stream_write, &stream,
+                                    resynth_result_width(result),
+                                    resynth_result_height(result),
+                                    resynth_result_channels(result),
+                                    resynth_result_pixels(result), 0);
+            resynth_phase("encode", false);
+            if (written) {
+                printf("encoded %zu\n", stream.output_size);
+                fwrite(stream.output, 1, stream.output_size, stdout);
+            } else {
+                err = "failed to encode";
+            }
+        }
+        if (err != NULL) printf("error %s\n", err);
+        fflush(stdout);
+
+        if (result != NULL) resynth_free_result(result);
+        if (params != NULL) resynth_free_parameters(params);
+        if (state != NULL) resynth_free_state(state);
+        resynth_phase("frame", false);
+    }
+    free(stream.input);
+    free(stream.output);
+    return ret;
+}
+
+// outputs are cached as {dir}/{hash}.png, with hard links where possible.
+// a hit touches the entry, and the least recently used entries are
+// evicted once the directory grows past its bound, checked once at the end.
+// autotuning picks by timing, so its choices are cached too, as
+// {dir}/{hash}.tune, keyed by the untuned parameters and the target.
+typedef struct {
+    const char *dir;
+    long long max_bytes;
+    int hits, misses, stored, evicted;
+} Cache;
+
+static char *cache_path(const Cache *cache, uint64_t key, const char *extension) {
+    const size_t size = strlen(cache->dir) + 32;
+    char *path = (char *)malloc(size);
+    snprintf(path, size, "%s/%016" PRIx64 "%s", cache->dir, key, extension);
+    return path;
+}
+
+static bool copy_file(const char *from, const char *to) {
+    FILE *in = fopen(from, "rb");
+    if (in == NULL) return false;
+    FILE *out = fopen(to, "wb");
+    if (out == NULL) {
+        fclose(in);
+        return false;
+    }
+    char buffer[65536];
+    size_t size;
+    bool ok = true;
+    while ((size = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, size, out) != size) ok = false;
+    }
+    if (ferror(in)) ok = false;
+    fclose(in);
+    if (fclose(out) != 0) ok = false;
+    if (!ok) remove(to);
+    return ok;
+}
+
+static bool place_file(const char *from, const char *to) {
+    // a hard link costs nothing, but not across filesystems.
+    remove(to);
+    return link(from, to) == 0 || copy_file(from, to);
+}
+
+static bool cache_fetch(Cache *cache, uint64_t key, const char *out_fn) {
+    char *path = cache_path(cache, key, ".png");
+    const bool hit = access(path, R_OK) == 0 && place_file(path, out_fn);
+    // hard links share their times, so this touches the output too.
+    if (hit) utimensat(AT_FDCWD, path, NULL, 0);
+    free(path);
+    if (hit) cache->hits++;
+    else cache->misses++;
+    return hit;
+}
+
+static void cache_trim(Cache *cache) {
+    DIR *dir = opendir(cache->dir);
+    if (dir == NULL) return;
+    struct entry { char *path; long long bytes; time_t used; } *entries = NULL;
+    int count = 0, capacity = 0;
+    long long total = 0;
+    struct dirent *it;
+    while ((it = readdir(dir)) != NULL) {
+        const size_t length = strlen(it->d_name);
+        if (length != 20 || strcmp(it->d_name + 16, ".png") != 0) continue;
+        const size_t size = strlen(cache->dir) + length + 2;
+        char *path = (char *)malloc(size);
+        snprintf(path, size, "%s/%s", cache->dir, it->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            free(path);
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            entries = realloc(entries, capacity * sizeof(*entries));
+        }
+        entries[count++] = (struct entry){path, (long long)st.st_size, st.st_mtime};
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    while (total > cache->max_bytes) {
+        int oldest = -1;
+        for (int i = 0; i < count; i++) {
+            if (entries[i].path == NULL) continue;
+            if (oldest < 0 || entries[i].used < entries[oldest].used) oldest = i;
+        }
+        if (oldest < 0) break;
+        remove(entries[oldest].path);
+        total -= entries[oldest].bytes;
+        free(entries[oldest].path);
+        entries[oldest].path = NULL;
+        cache->evicted++;
+    }
+    for (int i = 0; i < count; i++) free(entries[i].path);
+    free(entries);
+}
+
+static void cache_store(Cache *cache, uint64_t key, const char *out_fn) {
+    char *path = cache_path(cache, key, ".png");
+    if (!place_file(out_fn, path)) {
+        fprintf(stderr, "failed to cache: %s\n", out_fn);
+    } else {
+        cache->stored++;
+    }
+    free(path);
+}
+
+static bool cache_fetch_tuning(const Cache *cache, uint64_t key,
+                               resynth_tuning_t *tuning, int *reached) {
+    char *path = cache_path(cache, key, ".tune");
+    FILE *f = fopen(path, "r");
+    free(path);
+    if (f == NULL) return false;
+    const bool ok = fscanf(f, "%d %d %d %lf %lf %d", &tuning->neighbors,
+                           &tuning->tries, &tuning->magic, &tuning->energy,
+                           &tuning->seconds_per_pixel, reached) == 6;
+    fclose(f);
+    return ok;
+}
+
+static void cache_store_tuning(const Cache *cache, uint64_t key,
+                               const resynth_tuning_t *tuning, int reached) {
+    char *path = cache_path(cache, key, ".tune");
+    FILE *f = fopen(path, "w");
+    if (f != NULL) {
+        fprintf(f, "%d %d %d %.17g %.17g %d\n", tuning->neighbors,
+                tuning->tries, tuning->magic, tuning->energy,
+                tuning->seconds_per_pixel, reached);
+        if (fclose(f) != 0) remove(path);
+    }
+    free(path);
+}
 
 int main(int argc, char** argv) {
     int ret = 0;
-    int scale = 1;
-    int autism = 32;
-    int neighbors = 29;
-    int tries = 192;
-    int magic = 192;
-    unsigned long seed = 0;
+    Options o = default_options;
+    int checkpoint = 0;
+    int autotune = 0;
+    bool tracing = false;
+    bool streamed = false;
+    // the input itself, followed by any extra exemplars.
+    const char **exemplars = (const char **)calloc(argc, sizeof(char *));
+    int exemplar_count = 1;
+    Cache cache = {NULL, 1024LL << 20, 0, 0, 0, 0};
 
     KYAA_LOOP {
         KYAA_BEGIN
@@ -51,76 +514,268 @@ int main(int argc, char** argv) {
         KYAA_FLAG_LONG('a', "autism",
 "        sensitivity to outliers\n"
 "        range: [0,256];     default: 32")
-            autism = (double)(kyaa_long_value) / 256.;
+            o.autism = (double)(kyaa_long_value) / 256.;
 
         KYAA_FLAG_LONG('N', "neighbors",
 "        points to use when sampling\n"
 "        range: [0,1024];    default: 29")
-            neighbors = kyaa_long_value;
+            o.neighbors = kyaa_long_value;
 
         KYAA_FLAG_LONG('M', "tries",
 "        random points added to candidates\n"
 "        range: [0,65536];   default: 192")
-            tries = kyaa_long_value;
+            o.tries = kyaa_long_value;
 
         KYAA_FLAG_LONG('m', "magic",
 "        magic constant, affects iterations\n"
 "        range: [0,255];     default: 192")
-            magic = kyaa_long_value;
+            o.magic = kyaa_long_value;
 
         KYAA_FLAG_LONG('s', "scale",
 "        output size multiplier; negative values set width and height\n"
 "        range: [-8192,32];  default: 1")
-            scale = kyaa_long_value;
+            o.scale = kyaa_long_value;
 
         KYAA_FLAG_LONG('S', "seed",
 "        initial RNG value\n"
 "                            default: 0 [time(0)]")
-            seed = (unsigned long) kyaa_long_value;
+            o.seed = (unsigned long) kyaa_long_value;
+            o.seed_given = true;
+
+        KYAA_FLAG_LONG('W', "polish-worst",
+"        after -m, polish the worst pixels in up to this many passes\n"
+"        range: [0,1024];    default: 0 [disabled]")
+            o.polish_worst = kyaa_long_value;
+
+        KYAA_FLAG_LONG('X', "sparse",
+"        keep the nearest half of -N, spread the rest this far apart;\n"
+"        the last pass is dense\n"
+"        range: [0,64];      default: 0 [dense]")
+            o.sparse = kyaa_long_value;
+
+        KYAA_FLAG('T', "adaptive-tries",
+"        skip most random tries where neighbors already suggest a good match")
+            o.adaptive_tries = true;
+
+        KYAA_FLAG_LONG('t', "tile-size",
+"        synthesize in parallel tiles of this size; 0 disables tiling\n"
+"        range: [0,65536];   default: 0")
+            o.tile_size = kyaa_long_value;
+
+        KYAA_FLAG_LONG('o', "tile-overlap",
+"        seam band resynthesized on either side of each tile edge\n"
+"        range: [0,1024];    default: 8")
+            o.tile_overlap = kyaa_long_value;
+
+        KYAA_FLAG_LONG('j', "threads",
+"        worker threads for tiled synthesis\n"
+"        range: [0,1024];    default: 0 [one per core]")
+            o.threads = kyaa_long_value;
+
+        KYAA_FLAG_LONG('J', "shards",
+"        synthesize the tiles of -t in this many worker processes\n"
+"        range: [0,1024];    default: 0 [in this one]")
+            o.shards = kyaa_long_value;
+
+        KYAA_FLAG_LONG('p', "patch-size",
+"        quilt patches of this size instead of synthesizing per pixel\n"
+"        range: [0,1024];    default: 0 [per pixel]")
+            o.patch_size = kyaa_long_value;
+
+        KYAA_FLAG_LONG('P', "patch-overlap",
+"        overlap between quilted patches\n"
+"        range: [0,512];     default: 8")
+            o.patch_overlap = kyaa_long_value;
+
+        KYAA_FLAG_LONG('w', "wang-tile",
+"        assemble the output from 16 Wang tiles of this size\n"
+"        range: [0,8192];    default: 0 [disabled]")
+            o.wang_size = kyaa_long_value;
+
+        KYAA_FLAG_ARG('e', "exemplar",
+"        add this image as another exemplar of every input after it;\n"
+"        neighborhoods stay within one exemplar\n"
+"                            default: [none]")
+            exemplars[exemplar_count++] = kyaa_etc;
+
+        KYAA_FLAG_LONG('c', "checkpoint",
+"        save progress to {filename}.resynth.ckpt every so many seconds,\n"
+"        and resume from it if it exists\n"
+"        range: [0,86400];   default: 0 [disabled]")
+            checkpoint = kyaa_long_value;
+
+        KYAA_FLAG_LONG('d', "deadline",
+"        make a quick preview, then refine it for this many milliseconds\n"
+"        range: [0,86400000]; default: 0 [disabled]")
+            o.deadline = kyaa_long_value;
+
+        KYAA_FLAG_LONG('A', "autotune",
+"        pick the cheapest -N, -M and -m reaching this energy (x 1/10000)\n"
+"        range: [0,10000];   default: 0 [disabled]")
+            autotune = kyaa_long_value;
+
+        KYAA_FLAG_ARG('D', "trace",
+"        write a timeline of everything after this flag to a file,\n"
+"        as Chrome trace events (for chrome://tracing or Perfetto)\n"
+"                            default: [none]")
+            tracing = resynth_trace_start(kyaa_etc);
+            if (!tracing) return 1;
+
+        KYAA_FLAG_ARG('K', "cache",
+"        reuse outputs cached in this directory when the input, parameters\n"
+"        and version match, and cache new ones; needs an explicit -S\n"
+"                            default: [none]")
+            cache.dir = kyaa_etc;
+            if (mkdir(cache.dir, 0777) != 0 && errno != EEXIST) {
+                fprintf(stderr, "failed to create cache: %s\n", cache.dir);
+                return 1;
+            }
+
+        KYAA_FLAG_LONG('k', "cache-size",
+"        evict the least recently used outputs beyond this many MiB\n"
+"        range: [1,1048576]; default: 1024")
+            cache.max_bytes = (long long)(kyaa_long_value < 1 ? 1 : kyaa_long_value) << 20;
 
         KYAA_HELP("  {files...}\n"
-"        image files to open, resynthesize, and save as {filename}.resynth.png\n"
+"        image files to open, resynthesize, and save as {filename}.resynth.png;\n"
+"        - streams framed images from stdin to stdout instead\n"
 "        required            default: [none]")
 
         KYAA_END
 
         if (kyaa_read_stdin) {
-            fprintf(stderr, "fatal error: reading from stdin is unsupported\n");
-            exit(1);
+            kyaa_read_stdin = false;
+            streamed = true;
+            if (stream_frames(&o) != 0) ret--;
+            continue;
         }
 
         const char *fn = kyaa_arg;
+        resynth_phase(fn, true);
 
-        resynth_state_t state = resynth_state_create_from_image(fn, 3, 1);
-        resynth_parameters_t params = resynth_parameters_create();
-        resynth_parameters_outlier_sensitivity(params, autism);
-        resynth_parameters_neighbors(params, neighbors);
-        resynth_parameters_magic(params, magic);
-        resynth_parameters_tries(params, tries);
-        resynth_parameters_random_seed(params, seed);
+        exemplars[0] = fn;
+        resynth_state_t state = exemplar_count > 1
+            ? resynth_state_create_from_images(exemplars, exemplar_count, 3, o.scale)
+            : resynth_state_create_from_image(fn, 3, o.scale);
+        if (state == NULL) {
+            ret--;
+            resynth_phase(fn, false);
+            continue;
+        }
+        resynth_parameters_t params = options_parameters(&o);
 
-        resynth_result_t result = resynth_run(state, params);
+        // outputs only depend on their hash with a seed that was picked,
+        // and not the time a deadline happened to allow.
+        const bool cached = cache.dir != NULL && o.seed_given && o.deadline == 0;
 
-	printf("Channels %d", resynth_result_channels(result));
+        if (autotune > 0) {
+            // a cached choice is reused as is, so the output it's keyed by
+            // below is the one this target gave the first time around.
+            resynth_tuning_t tuning;
+            int reached = 0;
+            const uint64_t tuning_key = resynth_hash(state, params) ^
+                (uint64_t)autotune * 0xC2B2AE3D27D4EB4Full;
+            const bool tuned = cached &&
+                cache_fetch_tuning(&cache, tuning_key, &tuning, &reached);
+            if (tuned) {
+                resynth_parameters_neighbors(params, tuning.neighbors);
+                resynth_parameters_tries(params, tuning.tries);
+                resynth_parameters_magic(params, tuning.magic);
+            } else {
+                reached = resynth_autotune(state, params, autotune / 10000., &tuning);
+                if (cached) cache_store_tuning(&cache, tuning_key, &tuning, reached);
+            }
+            printf("autotune: -N %d -M %d -m %d # energy %.4f, %.3f us/px%s%s\n",
+                   tuning.neighbors, tuning.tries, tuning.magic, tuning.energy,
+                   tuning.seconds_per_pixel * 1e6,
+                   reached ? "" : " (target not reached)", tuned ? " (cached)" : "");
+        }
 
+        uint64_t key = 0;
+        if (cached) {
+            key = resynth_hash(state, params);
+            key ^= (uint64_t)o.wang_size * 0x9E3779B97F4A7C15ull;
+        }
         char *out_fn = manipulate_filename(fn, ".resynth.png");
+        if (cached && cache_fetch(&cache, key, out_fn)) {
+            puts(out_fn);
+            free(out_fn);
+            resynth_free_parameters(params);
+            resynth_free_state(state);
+            resynth_phase(fn, false);
+            continue;
+        }
+
+        char *checkpoint_fn = manipulate_filename(fn, ".resynth.ckpt");
+        if (checkpoint > 0) {
+            resynth_parameters_checkpoint(params, checkpoint_fn, checkpoint);
+        }
+
+        resynth_result_t result = NULL;
+        FILE *checkpoint_file = checkpoint > 0 ? fopen(checkpoint_fn, "rb") : NULL;
+        if (checkpoint_file != NULL) {
+            fclose(checkpoint_file);
+            result = resynth_resume(state, params, checkpoint_fn);
+            if (!resynth_result_valid(result)) {
+                fprintf(stderr, "starting over: %s\n", fn);
+                resynth_free_result(result);
+                result = NULL;
+            }
+        }
+
+        if (result == NULL) {
+            result = options_run(state, params, &o);
+            if (result == NULL) {
+                ret--;
+                free(out_fn);
+                free(checkpoint_fn);
+                resynth_free_parameters(params);
+                resynth_free_state(state);
+                resynth_phase(fn, false);
+                continue;
+            }
+            if (o.deadline > 0) printf("energy: %f\n", resynth_result_energy(result));
+        }
+
+	printf("Channels %d", resynth_result_channels(result));
+
         puts(out_fn);
+        // a fresh file, in case the old one is hard linked into a cache.
+        remove(out_fn);
+        resynth_phase("encode", true);
         int write_result = stbi_write_png(out_fn, 
                                     resynth_result_width(result), 
                                     resynth_result_height(result), 
                                     resynth_result_channels(result), 
                                     resynth_result_pixels(result), 
                                     0);
+        resynth_phase("encode", false);
         if (!write_result) {
             fprintf(stderr, "failed to write: %s\n", out_fn);
             ret--;
+        } else {
+            if (checkpoint > 0) remove(checkpoint_fn);
+            if (cached) cache_store(&cache, key, out_fn);
         }
 
         free(out_fn);
+        free(checkpoint_fn);
         resynth_free_result(result);
         resynth_free_parameters(params);
         resynth_free_state(state);
+        resynth_phase(fn, false);
     }
 
+    if (cache.stored > 0) cache_trim(&cache);
+    // when streaming, stdout is taken.
+    if (cache.dir != NULL && !streamed) {
+        if (!o.seed_given) {
+            fprintf(stderr, "cache unused: outputs are only cached with -S\n");
+        }
+        printf("cache: %d hits, %d misses, %d evicted\n",
+               cache.hits, cache.misses, cache.evicted);
+    }
+    if (tracing) resynth_trace_stop();
+    free(exemplars);
     return ret;
 }
@@ -48,7 +48,11 @@
 #define RND_U64 uint64_t
 #define RND_IMPLEMENTATION
 #include "rnd.h"
-rnd_pcg_t pcg;
+
+// parallel work runs on a pool of pthreads, unless an executor is given.
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h> // for sysconf
 
 // convenience macros. hopefully these names don't interfere
 // with any defined in the standard library headers on any system.
@@ -79,14 +83,96 @@ rnd_pcg_t pcg;
 // their symbols being exported, thus truly allowing them to be inlined.
 #define INLINE static inline
 
-// end of generic boilerplate, here's the actual program:
-struct _Resynth_result {
-    uint8_t* pixels;
-    float* pixelsf;
-    size_t width, height, channels;
-    bool valid;
-};
+static double monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static double thread_seconds(void) {
+    // CPU time spent by the calling thread, unaffected by other threads.
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// 64-bit FNV-1a, for telling apart inputs without keeping them around.
+#define HASH_INIT 0xCBF29CE484222325ull
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+#define HASH_VALUE(hash, value) ((hash) = hash_bytes((hash), &(value), sizeof(value)))
+
+// bump this whenever the same state and parameters give a different output,
+// so outputs kept around by their resynth_hash aren't mistaken for new ones.
+#define RESYNTH_VERSION 1
+
+// phases of the work are reported as they begin and end, to a hook
+// and/or as Chrome trace events, with a track for every thread.
+// phases are coarse (passes, tiles and such), so this costs nothing
+// when neither is set, and little when they are.
+static struct {
+    pthread_mutex_t lock;
+    atomic_bool active;
+    FILE *file;
+    bool first_event;
+    double origin;
+    int generation; // of the file, counting every start
+    int threads; // numbered in this file so far
+    resynth_phase_hook_t hook;
+    void *user;
+} tracing = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// a thread is numbered on its first event in every file, and named there.
+static _Thread_local struct {
+    int id;
+    int generation; // 0 until the thread's first event
+} trace_thread;
+
+static void trace__event(const char *name, const char *phase, double now) {
+    // writes an event; the lock must be held.
+    FILE *f = tracing.file;
+    if (trace_thread.generation != tracing.generation) {
+        trace_thread.generation = tracing.generation;
+        trace_thread.id = ++tracing.threads;
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                   "\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                tracing.first_event ? "" : ",\n", trace_thread.id, trace_thread.id);
+        tracing.first_event = false;
+    }
+    fprintf(f, "%s{\"name\":\"", tracing.first_event ? "" : ",\n");
+    for (const char *c = name; *c; c++) {
+        if (*c == '"' || *c == '\\') fputc('\\', f);
+        if ((unsigned char)*c >= ' ') fputc(*c, f);
+    }
+    fprintf(f, "\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+            phase, (now - tracing.origin) * 1e6, trace_thread.id);
+    tracing.first_event = false;
+}
+
+static void phase(const char *name, bool begin) {
+    if (!atomic_load_explicit(&tracing.active, memory_order_relaxed)) return;
+    const double now = monotonic_seconds();
+    pthread_mutex_lock(&tracing.lock);
+    if (tracing.file) trace__event(name, begin ? "B" : "E", now);
+    resynth_phase_hook_t hook = tracing.hook;
+    void *user = tracing.user;
+    pthread_mutex_unlock(&tracing.lock);
+    if (hook) hook(user, name, begin);
+}
+
+static void tracing__update(void) {
+    // the lock must be held.
+    atomic_store(&tracing.active, tracing.file != NULL || tracing.hook != NULL);
+}
 
+// end of generic boilerplate, here's the actual program:
 typedef struct coord {
     int x, y;
 } Coord;
@@ -119,6 +205,18 @@ typedef struct {
     Coord source;
 } Status;
 
+struct _Resynth_result {
+    uint8_t* pixels;
+    float* pixelsf;
+    const Status *status; // belongs to the state, if any
+    int32_t *sources;
+    size_t width, height, channels;
+    double energy; // negative if it wasn't measured
+    bool valid;
+    bool owns_pixels; // otherwise, pixels belong to the state
+    struct Buffers *buffers; // if detached: pixels go back here, status is ours
+};
+
 typedef struct {
     int width, height, depth;
 } Image;
@@ -142,6 +240,20 @@ struct _Parameters {
     int neighbors, tries;
     int magic;
     int random_seed;
+    int tile_size, tile_overlap;
+    int threads;
+    resynth_engine_t engine;
+    int patch_size, patch_overlap;
+    char *checkpoint_path;
+    double checkpoint_interval;
+    resynth_polish_t polish;
+    double polish_target;
+    int polish_passes;
+    bool generic_kernel;
+    bool adaptive_tries;
+    int sparse_core, sparse_dilation, dense_passes;
+    resynth_executor_t executor;
+    // (anything here that changes the output must go into resynth_hash.)
 };
 
 INLINE bool wrap_or_clip(const Parameters parameters, const Image image,
@@ -167,40 +279,162 @@ INLINE bool wrap_or_clip(const Parameters parameters, const Image image,
     return true;
 }
 
+// the order pixels are visited in, without keeping a list of them:
+// a random permutation of every pixel, computed as it goes, followed by
+// a prefix of it for each pass magic makes, all visited from the end
+// like data_points. starts has the index where each of those passes begins,
+// and is kept for data_points as well, for tracing each pass.
+#define ORDER_ROUNDS 4
+
+typedef struct {
+    uint32_t keys[ORDER_ROUNDS];
+    int bits;    // in either half of the numbers being permuted
+    int count;   // of pixels; 0 when data_points is used instead
+    int total;   // of points, over every pass
+    int *starts; // (stretchy buffer)
+} Order;
+
+// a corpus of several exemplars is an atlas of them side by side,
+// aligned to the top. whatever is below an exemplar belongs to none,
+// and no neighborhood reaches past its own exemplar (see try_point_with).
+// exemplars' pixels are numbered one after another, for random picks.
+typedef struct {
+    int x, width, height;
+    int first; // the number of the exemplar's first pixel
+} Exemplar;
+
+struct _Resynth_state;
+typedef int (*Try_kernel)(struct _Resynth_state *s,
+                          const Coord *points, int count);
+
 struct _Resynth_state {
+    // tiles borrow the read-only corpus and tables of the state they belong to.
+    const struct _Resynth_state *parent;
+    rnd_pcg_t rng;
+
     int input_bytes;
     // note that these variables must exist alongside their "_array"s
     // for the image macros to work.
     Image data, corpus, status;
     Pixel *data_array, *corpus_array;
     Status *status_array;
-    Coord *data_points, *corpus_points, *sorted_offsets;
+    // with several exemplars, the exemplar each corpus column belongs to.
+    // with fewer, the whole corpus is the only exemplar.
+    Exemplar *exemplars;
+    int *exemplar_columns;
+    int exemplar_count, exemplar_area;
+    Coord *data_points, *sorted_offsets;
+    Order order; // takes the place of data_points for fresh runs
+    int sparse_from; // data points from this index on gather sparsely
     Image tried;
     int *tried_array;
+    int visits;
+    Image cost; // of each pixel's match as of its last visit
+    float *cost_array;
 
     Coord *neighbors;
     Pixel32 *neighbor_values;
     Status **neighbor_statuses;
     int n_neighbors;
 
+    // candidates for the pixel being synthesized, and the RNG after each draw.
+    Coord *candidates;
+    rnd_pcg_t *candidate_rngs;
+    Try_kernel try_kernel;
+
     int *diff_table; // (might be more efficient to store as uint16_t?)
 
     int best;
     Coord best_point;
+
+    // running statistics of the cost of the pixels picked, for adaptive tries.
+    int tries_samples;
+    double tries_mean, tries_var;
+
+    double checkpoint_due; // in monotonic seconds, or 0 when not checkpointing
+    double deadline; // likewise, for stopping early
+    bool warm; // the next run starts from the current statuses
+
+    // with detached results, the last one's pixels and statuses are only
+    // lent to the state until it needs them again for the next run.
+    resynth_ownership_t ownership;
+    struct Buffers *buffers;
+    bool lent;
 };
 
+static void buffers_release(struct Buffers *buffers);
+
 static void state_free(Resynth_state *s) {
+    if (s->lent) {
+        // these belong to a result now.
+        s->data_array = NULL;
+        s->status_array = NULL;
+        s->lent = false;
+    }
+    if (s->buffers) buffers_release(s->buffers);
+    s->buffers = NULL;
+    if (s->parent) {
+        // these belong to the parent state; don't free them twice.
+        s->sorted_offsets = NULL;
+        s->diff_table = NULL;
+        s->corpus_array = NULL;
+        s->exemplars = NULL;
+        s->exemplar_columns = NULL;
+    }
     sb_freeset(s->data_points);
-    sb_freeset(s->corpus_points);
+    sb_freeset(s->order.starts);
     sb_freeset(s->sorted_offsets);
     MEMORY(s->diff_table, 0);
     MEMORY(s->neighbors, 0);
     MEMORY(s->neighbor_values, 0);
     MEMORY(s->neighbor_statuses, 0);
+    MEMORY(s->candidates, 0);
+    MEMORY(s->candidate_rngs, 0);
     MEMORY(s->data_array, 0);
     MEMORY(s->corpus_array, 0);
+    MEMORY(s->exemplars, 0);
+    MEMORY(s->exemplar_columns, 0);
     MEMORY(s->status_array, 0);
     MEMORY(s->tried_array, 0);
+    MEMORY(s->cost_array, 0);
+}
+
+INLINE Exemplar exemplar_of(const Resynth_state *s, int x) {
+    // the exemplar a corpus column belongs to.
+    if (s->exemplar_count <= 1) {
+        return (Exemplar){0, s->corpus.width, s->corpus.height, 0};
+    }
+    return s->exemplars[s->exemplar_columns[x]];
+}
+
+INLINE bool exemplar_contains(const Exemplar e, const Coord point) {
+    return point.x >= e.x && point.y >= 0 &&
+           point.x < e.x + e.width && point.y < e.height;
+}
+
+INLINE int corpus_area(const Resynth_state *s) {
+    // the number of pixels that belong to an exemplar.
+    if (s->exemplar_count <= 1) return s->corpus.width * s->corpus.height;
+    return s->exemplar_area;
+}
+
+INLINE Coord corpus_pixel(const Resynth_state *s, int index) {
+    // pixel number index, out of corpus_area.
+    if (s->exemplar_count <= 1) {
+        return (Coord){index % s->corpus.width, index / s->corpus.width};
+    }
+    const Exemplar *e = s->exemplars;
+    while (index >= e->first + e->width * e->height) e++;
+    index -= e->first;
+    return (Coord){e->x + index % e->width, index / e->width};
+}
+
+INLINE bool corpus_has(const Resynth_state *s, const Coord point) {
+    // whether a point of the corpus belongs to an exemplar.
+    if (point.x < 0 || point.y < 0 ||
+        point.x >= s->corpus.width || point.y >= s->corpus.height) return false;
+    return s->exemplar_count <= 1 ||
+           point.y < s->exemplars[s->exemplar_columns[point.x]].height;
 }
 
 static double neglog_cauchy(double x) {
@@ -228,36 +462,95 @@ static void make_offset_list(Resynth_state *s) {
           sizeof(Coord), coord_compare);
 }
 
-INLINE void try_point(Resynth_state *s, const Coord point) {
+static void make_diff_table(Resynth_state *s, Parameters parameters) {
+    // (iirc i opted to put diff_table on heap to keep Resynth_state small)
+    MEMORY(s->diff_table, 512);
+
+    // precompute how "different" a pixel value is from another.
+    // this greatly affects how apparent any seams are in the synthesized image.
+    // this is done per 8-bit channel, so only 256 * 2 values are needed.
+    // since we can't use negative indices, we pretend index 256 is 0 instead.
+    // (you could try adding CIELAB heuristics, but this seems robust enough)
+    if (parameters.autism > 0) for (int i = -256; i < 256; i++) {
+        double value = neglog_cauchy(i / 256.0 / parameters.autism) /
+                       neglog_cauchy(1.0 / parameters.autism) * 65536.0;
+        s->diff_table[256 + i] = (int)(value);
+    } else for (int i = -256; i < 256; i++) {
+        s->diff_table[256 + i] = (int)(i != 0) * 65536;
+    }
+}
+
+INLINE int add_diff(const Resynth_state *s, const Coord point, int i,
+                    int sum, int diff) {
+#ifdef NDEBUG
+    (void)s, (void)point, (void)i;
+    return sum + diff;
+#else
+    if (__builtin_add_overflow(sum, diff, &sum)) {
+        fprintf(stderr, "integer overflow at (%i,%i) + (%i,%i)\n",
+                point.x, point.y, s->neighbors[i].x, s->neighbors[i].y);
+        fprintf(stderr, "diff: %i\n", diff);
+        exit(1);
+    }
+    return sum;
+#endif
+}
+
+// candidates are scattered all over the corpus, so for a large corpus
+// nearly every one of them starts with a cache miss. to overlap those
+// misses, the neighborhoods of the candidates TRY_AHEAD places ahead are
+// prefetched while the current one is evaluated. only the first few
+// neighbors are fetched, since most candidates are rejected by then.
+// corpora small enough to stay in cache are better off without.
+// (evaluating several candidates in lockstep overlaps misses as well,
+// but then they can't share the bound as it improves, which costs more)
+#define TRY_AHEAD 8
+#define TRY_PREFETCH 4
+#define TRY_PREFETCH_BYTES (512 * 1024)
+
+INLINE void prefetch_point(const Resynth_state *s, const Coord point) {
+    for (int i = 0; i < MIN(s->n_neighbors, TRY_PREFETCH); i++) {
+        Coord off_point = coord_add(point, s->neighbors[i]);
+        if (off_point.x < 0 || off_point.y < 0 ||
+            off_point.x >= s->corpus.width || off_point.y >= s->corpus.height) {
+            continue;
+        }
+        __builtin_prefetch(image_atc(s->corpus, off_point));
+    }
+}
+
+// try_points is written once, as a template of sorts: the kernels below
+// are the same code with the channel and neighbor counts fixed at compile
+// time, so their loops can be unrolled, while the generic kernel reads them
+// from the state. a kernel is picked once per run (see pick_kernel).
+// pixels with fewer neighbors than usual, i.e. those synthesized early on,
+// go through the generic kernel. in every kernel, candidates whose whole
+// neighborhood lies within their exemplar skip the bounds checks.
+#define KERNEL static inline __attribute__((always_inline))
+
+KERNEL void try_point_with(Resynth_state *s, const Coord point,
+                           const int channels, const int neighbors,
+                           const bool interior, const Exemplar exemplar) {
     // consider a candidate pixel for the best-fit by considering its neighbors.
     int sum = 0;
 
-    for (int i = 0; i < s->n_neighbors; i++) {
+    for (int i = 0; i < neighbors; i++) {
         Coord off_point = coord_add(point, s->neighbors[i]);
 
         int diff = 0;
-        if (off_point.x < 0 || off_point.y < 0 ||
-            off_point.x >= s->corpus.width || off_point.y >= s->corpus.height) {
-            // penalize edges, assuming the corpus image doesn't wrap cleanly.
-            diff = s->diff_table[0] * s->input_bytes;
+        if (!interior && !exemplar_contains(exemplar, off_point)) {
+            // penalize edges, assuming the corpus image doesn't wrap cleanly,
+            // and likewise those between exemplars.
+            diff = s->diff_table[0] * channels;
         } else if (i) {
             const Pixel *corpus_pixel = image_atc(s->corpus, off_point);
             const Pixel *data_pixel = s->neighbor_values[i].v;
-            for (int j = 0; j < s->input_bytes; j++) {
+            for (int j = 0; j < channels; j++) {
                 diff += s->diff_table[256 + data_pixel[j] - corpus_pixel[j]];
             }
         }
 
-#ifdef NDEBUG
-        sum += diff;
-#else
-        if (__builtin_add_overflow(sum, diff, &sum)) {
-            fprintf(stderr, "integer overflow at (%i,%i) + (%i,%i)\n",
-                    point.x, point.y, s->neighbors[i].x, s->neighbors[i].y);
-            fprintf(stderr, "diff: %i\n", diff);
-            exit(1);
-        }
-#endif
+        sum = add_diff(s, point, i, sum, diff);
         if (sum >= s->best) return;
     }
 
@@ -265,148 +558,590 @@ INLINE void try_point(Resynth_state *s, const Coord point) {
     s->best_point = point;
 }
 
-INLINE void resynth__init(Resynth_state *s, Parameters parameters) {
-    sb_freeset(s->data_points);
-    sb_freeset(s->corpus_points);
-    sb_freeset(s->sorted_offsets);
-
-    // (iirc i opted to put diff_table on heap to keep Resynth_state small)
-    MEMORY(s->diff_table, 512);
-    MEMORY(s->neighbors, parameters.neighbors);
-    MEMORY(s->neighbor_values, parameters.neighbors);
-    MEMORY(s->neighbor_statuses, parameters.neighbors);
+INLINE void try_point(Resynth_state *s, const Coord point) {
+    try_point_with(s, point, s->input_bytes, s->n_neighbors, false,
+                   exemplar_of(s, point.x));
+}
 
-    IMAGE_RESIZE(s->status, s->data.width, s->data.height, 1);
+KERNEL int try_points_with(Resynth_state *s, const Coord *points, int count,
+                           const int channels, const int neighbors) {
+    // returns how many candidates were needed, which is fewer than count
+    // when a perfect match turns up and the rest are left untried.
+    Coord low = {0, 0}, high = {0, 0};
+    for (int i = 0; i < neighbors; i++) {
+        low.x = MIN(low.x, s->neighbors[i].x);
+        low.y = MIN(low.y, s->neighbors[i].y);
+        high.x = MAX(high.x, s->neighbors[i].x);
+        high.y = MAX(high.y, s->neighbors[i].y);
+    }
 
-    // set default values and allocate points to shuffle later.
-    for (int y = 0; y < s->status.height; y++) {
-        for (int x = 0; x < s->status.width; x++) {
-            // (this might be redundant since this memory is calloc'd)
-            image_at(s->status, x, y)->has_source = false;
-            image_at(s->status, x, y)->has_value = false;
+    const bool prefetch = (size_t)s->corpus.width * s->corpus.height *
+                          s->corpus.depth > TRY_PREFETCH_BYTES;
+    if (prefetch) for (int k = 0; k < MIN(count, TRY_AHEAD); k++) {
+        prefetch_point(s, points[k]);
+    }
 
-            Coord coord = {x, y};
-            sb_push(s->data_points, coord);
+    for (int k = 0; k < count; k++) {
+        if (prefetch && k + TRY_AHEAD < count) {
+            prefetch_point(s, points[k + TRY_AHEAD]);
         }
+        const Coord point = points[k];
+        const Exemplar e = exemplar_of(s, point.x);
+        if (point.x + low.x >= e.x && point.y + low.y >= 0 &&
+            point.x + high.x < e.x + e.width && point.y + high.y < e.height) {
+            try_point_with(s, point, channels, neighbors, true, e);
+        } else {
+            try_point_with(s, point, channels, neighbors, false, e);
+        }
+        if (s->best == 0) return k + 1;
+    }
+    return count;
+}
+
+static int try_points_generic(Resynth_state *s, const Coord *points, int count) {
+    return try_points_with(s, points, count, s->input_bytes, s->n_neighbors);
+}
+
+#define TRY_KERNEL(channels, neighbors) \
+    static int try_points_c##channels##n##neighbors( \
+            Resynth_state *s, const Coord *points, int count) { \
+        if (s->n_neighbors != neighbors) { \
+            return try_points_generic(s, points, count); \
+        } \
+        return try_points_with(s, points, count, channels, neighbors); \
     }
 
-    // likewise for the corpus.
-    for (int y = 0; y < s->corpus.height; y++) {
-        for (int x = 0; x < s->corpus.width; x++) {
-            Coord coord = {x, y};
-            sb_push(s->corpus_points, coord);
-        }
+TRY_KERNEL(3, 29)
+TRY_KERNEL(3, 45)
+TRY_KERNEL(4, 29)
+TRY_KERNEL(4, 45)
+
+static const struct {
+    int channels, neighbors;
+    Try_kernel kernel;
+    const char *name;
+} try_kernels[] = {
+    {3, 29, try_points_c3n29, "c3n29"},
+    {3, 45, try_points_c3n45, "c3n45"},
+    {4, 29, try_points_c4n29, "c4n29"},
+    {4, 45, try_points_c4n45, "c4n45"},
+};
+
+static int pick_kernel(const Resynth_state *s, Parameters parameters) {
+    // an index into try_kernels, or -1 for the generic kernel.
+    if (parameters.generic_kernel) return -1;
+    for (int i = 0; i < (int)LEN(try_kernels); i++) {
+        if (try_kernels[i].channels == s->input_bytes &&
+            try_kernels[i].neighbors == parameters.neighbors) return i;
     }
+    return -1;
+}
+
+INLINE float resynth__cost(const Resynth_state *s) {
+    // the best match so far, per neighbor and channel, between 0 and 1.
+    double cost = s->best / (65536.0 * s->input_bytes *
+                             MAX(s->n_neighbors - 1, 1));
+    return (float)MIN(cost, 1.0);
+}
+
+static bool resynth__tables(Resynth_state *s, Parameters parameters) {
+    // everything in here only depends on the corpus and the parameters,
+    // so it can be shared by every tile of a tiled run.
+    sb_freeset(s->sorted_offsets);
 
-    if (!sb_count(s->corpus_points) || !sb_count(s->data_points)) {
+    const int corpus_area = s->corpus.width * s->corpus.height;
+    const int data_area = s->data.width * s->data.height;
+    if (!corpus_area || !data_area) {
         fprintf(stderr, "invalid sizes\n");
-        fprintf(stderr, "corpus: %i\n", sb_count(s->corpus_points));
-        fprintf(stderr, "data: %i\n", sb_count(s->data_points));
-        return;
+        fprintf(stderr, "corpus: %i\n", corpus_area);
+        fprintf(stderr, "data: %i\n", data_area);
+        return false;
     }
 
+    phase("offsets", true);
     make_offset_list(s);
+    phase("offsets", false);
+    phase("diff table", true);
+    make_diff_table(s, parameters);
+    phase("diff table", false);
 
-    // precompute how "different" a pixel value is from another.
-    // this greatly affects how apparent any seams are in the synthesized image.
-    // this is done per 8-bit channel, so only 256 * 2 values are needed.
-    // since we can't use negative indices, we pretend index 256 is 0 instead.
-    // (you could try adding CIELAB heuristics, but this seems robust enough)
-    if (parameters.autism > 0) for (int i = -256; i < 256; i++) {
-        double value = neglog_cauchy(i / 256.0 / parameters.autism) /
-                       neglog_cauchy(1.0 / parameters.autism) * 65536.0;
-        s->diff_table[256 + i] = (int)(value);
-    } else for (int i = -256; i < 256; i++) {
-        s->diff_table[256 + i] = (int)(i != 0) * 65536;
-    }
+    return true;
+}
 
-    const int data_area = sb_count(s->data_points);
+static void resynth__work(Resynth_state *s, Parameters parameters) {
+    // per-run scratch memory. tiles each get their own.
+    MEMORY(s->neighbors, parameters.neighbors);
+    MEMORY(s->neighbor_values, parameters.neighbors);
+    MEMORY(s->neighbor_statuses, parameters.neighbors);
+    MEMORY(s->candidates, MAX(parameters.neighbors, parameters.tries));
+    MEMORY(s->candidate_rngs, parameters.tries);
+    const int kernel = pick_kernel(s, parameters);
+    s->try_kernel = kernel < 0 ? try_points_generic : try_kernels[kernel].kernel;
+
+    // (this also clears any statuses left over from a previous run,
+    // unless they were put there on purpose to warm start from)
+    if (!s->warm) IMAGE_RESIZE(s->status, s->data.width, s->data.height, 1);
+    IMAGE_RESIZE(s->cost, s->data.width, s->data.height, 1);
+
+    // prepare an array of neighbors we've already computed the difference of.
+    // this is a simple optimization and isn't critical to the algorithm.
+    // (tried_array is referred to implicitly by macros)
+    IMAGE_RESIZE(s->tried, s->corpus.width, s->corpus.height, 1);
+    const int corpus_area = s->corpus.width * s->corpus.height;
+    for (int i = 0; i < corpus_area; i++) s->tried_array[i] = -1;
+    s->visits = 0;
+    s->tries_samples = 0;
+    s->tries_mean = s->tries_var = 0;
+    s->sparse_from = INT_MAX;
+}
 
-    // shuffle the data points in-place.
-    for (int i = 0; i < data_area; i++) {
-        int j = rnd_pcg_range(&pcg, 0, data_area - 1);
-        Coord temp = s->data_points[i];
-        s->data_points[i] = s->data_points[j];
-        s->data_points[j] = temp;
+static void shuffle_points(rnd_pcg_t *rng, Coord *points, int count) {
+    // shuffle the points in-place.
+    for (int i = 0; i < count; i++) {
+        int j = rnd_pcg_range(rng, 0, count - 1);
+        Coord temp = points[i];
+        points[i] = points[j];
+        points[j] = temp;
     }
+}
+
+static void points__clear(Resynth_state *s) {
+    sb_freeset(s->data_points);
+    sb_freeset(s->order.starts);
+    s->order.count = 0;
+}
+
+static void resynth__polish(Resynth_state *s, Parameters parameters) {
+    const int data_area = sb_count(s->data_points);
+    phase("shuffle", true);
+    shuffle_points(&s->rng, s->data_points, data_area);
+    phase("shuffle", false);
 
     // polishing improves pixels chosen early in the algorithm
     // by reconsidering them after the output image has been filled.
     // this greatly reduces the "sparklies" in the resulting image.
     // this is achieved by appending the first n data points to the end.
     // n is reduced exponentially by "magic" until it's less than 1.
+    // with sparse neighborhoods, the passes this makes are sparse,
+    // except for the last dense_passes of them to be visited.
+    // (points are visited from the end, so passes appended later go first,
+    // and the first one, which has every point, goes last.)
+    const int dense = parameters.sparse_core ? parameters.dense_passes : INT_MAX;
+    s->sparse_from = dense <= 0 ? 0 : dense == 1 ? data_area : INT_MAX;
+    // (the number of points is capped at what an int can count.)
+    phase("polish setup", true);
+    int passes = 1;
     if (parameters.magic) for (int n = data_area; n > 0;) {
-        n = n * parameters.magic / 256;
-        for (int i = 0; i < n; i++) {
-            sb_push(s->data_points, s->data_points[i]);
+        n = (int)((int64_t)n * parameters.magic / 256);
+        if (n > INT_MAX - sb_count(s->data_points)) break;
+        if (n > 0) {
+            sb_push(s->order.starts, sb_count(s->data_points));
+            Coord *pass = sb_add(s->data_points, n);
+            memcpy(pass, s->data_points, n * sizeof(Coord));
         }
+        if (++passes == dense) s->sparse_from = sb_count(s->data_points);
     }
+    phase("polish setup", false);
+}
 
-    // prepare an array of neighbors we've already computed the difference of.
-    // this is a simple optimization and isn't critical to the algorithm.
-    // (tried_array is referred to implicitly by macros)
-    IMAGE_RESIZE(s->tried, s->corpus.width, s->corpus.height, 1);
-    const int corpus_area = s->corpus.width * s->corpus.height;
-    for (int i = 0; i < corpus_area; i++) s->tried_array[i] = -1;
+static void resynth__points(Resynth_state *s, Parameters parameters) {
+    // allocate points to shuffle and polish.
+    // pixels that already have a value are kept as they are.
+    points__clear(s);
+    phase("list points", true);
+    Coord *points = sb_add(s->data_points, s->data.width * s->data.height);
+    int count = 0;
+    for (int y = 0; y < s->data.height; y++) {
+        for (int x = 0; x < s->data.width; x++) {
+            if (image_at(s->status, x, y)->has_value) continue;
+            points[count++] = (Coord){x, y};
+        }
+    }
+    stb__sbn(s->data_points) = count;
+    phase("list points", false);
+    resynth__polish(s, parameters);
 }
 
-static void resynth(Resynth_state *s, Parameters parameters) {
-    // "resynthesize" an output image from a given input image.
-    resynth__init(s, parameters);
+static void order__passes(Resynth_state *s, Parameters parameters) {
+    // the same passes resynth__polish makes, as offsets instead of copies.
+    Order *order = &s->order;
+    sb_freeset(order->starts);
+    const int dense = parameters.sparse_core ? parameters.dense_passes : INT_MAX;
+    s->sparse_from = dense <= 0 ? 0 : dense == 1 ? order->count : INT_MAX;
+    int total = order->count, passes = 1;
+    if (parameters.magic) for (int n = order->count; n > 0;) {
+        n = (int)((int64_t)n * parameters.magic / 256);
+        if (n > INT_MAX - total) break;
+        if (n > 0) sb_push(order->starts, total);
+        total += n;
+        if (++passes == dense) s->sparse_from = total;
+    }
+    order->total = total;
+}
 
-    for (int i = sb_count(s->data_points) - 1; i >= 0; i--) {
-        Coord position = s->data_points[i];
+static void resynth__order(Resynth_state *s, Parameters parameters) {
+    // like resynth__points for an image without any values yet,
+    // but without listing or shuffling anything, which takes a while
+    // for huge images: every pixel is simply visited in a random order.
+    Order *order = &s->order;
+    points__clear(s);
+    phase("order", true);
+    order->count = s->data.width * s->data.height;
+    order->bits = 0;
+    while ((1ull << (2 * order->bits)) < (uint64_t)order->count) order->bits++;
+    for (int i = 0; i < ORDER_ROUNDS; i++) order->keys[i] = rnd_pcg_next(&s->rng);
+    order__passes(s, parameters);
+    phase("order", false);
+}
 
-        // this point is guaranteed to have a value after this iteration.
-        image_atc(s->status, position)->has_value = true;
+INLINE uint32_t order__mix(uint32_t x) {
+    // the murmur3 finalizer.
+    x ^= x >> 16;
+    x *= 0x85EBCA6Bu;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35u;
+    x ^= x >> 16;
+    return x;
+}
 
-        // collect neighboring pixels as candidates for best-fit.
-        // the order we check and collect is relevant, thus "sorted_offsets".
-        s->n_neighbors = 0;
-        const int sorted_offsets_size = sb_count(s->sorted_offsets);
-        for (int j = 0; j < sorted_offsets_size; j++) {
-            Coord point = coord_add(position, s->sorted_offsets[j]);
-
-            if (wrap_or_clip(parameters, s->data, &point) &&
-                image_atc(s->status, point)->has_value) {
-                s->neighbors[s->n_neighbors] = s->sorted_offsets[j];
-                s->neighbor_statuses[s->n_neighbors] =
-                    image_atc(s->status, point);
-                for (int k = 0; k < s->input_bytes; k++) {
-                    s->neighbor_values[s->n_neighbors].v[k] =
-                        image_atc(s->data, point)[k];
-                }
-                s->n_neighbors++;
-                if (s->n_neighbors >= parameters.neighbors) break;
+INLINE int order__at(const Order *order, int index) {
+    // a small Feistel network shuffles the numbers below 4^bits,
+    // and repeating it until the number is in range again
+    // shuffles the ones below count. (this takes 4 tries at most, on average.)
+    const uint32_t mask = (1u << order->bits) - 1;
+    uint32_t x = (uint32_t)index;
+    do {
+        uint32_t left = x >> order->bits, right = x & mask;
+        for (int i = 0; i < ORDER_ROUNDS; i++) {
+            const uint32_t next = left ^ (order__mix(right ^ order->keys[i]) & mask);
+            left = right;
+            right = next;
+        }
+        x = left << order->bits | right;
+    } while (x >= (uint32_t)order->count);
+    return (int)x;
+}
+
+INLINE Coord resynth__point(const Resynth_state *s, int i) {
+    // the i'th point to visit, whether listed or implicit.
+    const Order *order = &s->order;
+    if (!order->count) return s->data_points[i];
+    if (i >= order->count) {
+        // find the pass i belongs to.
+        int low = 0, high = sb_count(order->starts) - 1;
+        while (low < high) {
+            const int middle = (low + high + 1) / 2;
+            if (order->starts[middle] <= i) low = middle;
+            else high = middle - 1;
+        }
+        i -= order->starts[low];
+    }
+    const int pixel = order__at(order, i);
+    return (Coord){pixel % s->data.width, pixel / s->data.width};
+}
+
+INLINE int resynth__count(const Resynth_state *s) {
+    return s->order.count ? s->order.total : sb_count(s->data_points);
+}
+
+static void resynth__refine_points(Resynth_state *s, Parameters parameters) {
+    // warm starts visit every pixel they were given exactly once,
+    // like a polishing pass, after any missing pixels have been filled in.
+    // since these already have coherent neighbors, one pass is enough.
+    Coord *points = NULL;
+    for (int y = 0; y < s->data.height; y++) {
+        for (int x = 0; x < s->data.width; x++) {
+            if (!image_at(s->status, x, y)->has_value) continue;
+            Coord coord = {x, y};
+            sb_push(points, coord);
+        }
+    }
+    shuffle_points(&s->rng, points, sb_count(points));
+
+    // points are visited from the end, so the missing ones go last.
+    // the points given are revisited densely, like a last pass.
+    resynth__points(s, parameters);
+    const int given = sb_count(points);
+    if (s->sparse_from != INT_MAX) s->sparse_from += given;
+    for (int i = 0; i < sb_count(s->data_points); i++) {
+        sb_push(points, s->data_points[i]);
+    }
+    sb_freeset(s->data_points);
+    s->data_points = points;
+
+    // the missing points' passes start after the given ones now.
+    int *starts = NULL;
+    if (given && sb_count(points) > given) sb_push(starts, given);
+    for (int i = 0; i < sb_count(s->order.starts); i++) {
+        sb_push(starts, s->order.starts[i] + given);
+    }
+    sb_freeset(s->order.starts);
+    s->order.starts = starts;
+}
+
+static bool resynth__init(Resynth_state *s, Parameters parameters) {
+    if (!resynth__tables(s, parameters)) return false;
+    resynth__work(s, parameters);
+    if (s->warm) resynth__refine_points(s, parameters);
+    else resynth__order(s, parameters);
+    s->warm = false;
+    return true;
+}
+
+// checkpoints hold everything resynth__synthesize needs to pick up
+// where it left off: the output so far, its statuses, the list of points,
+// how many of them remain, and the RNG. resuming from one gives
+// the same output as a run that was never interrupted.
+// only plain (untiled, per-pixel) runs are checkpointed.
+// the file is a raw dump, so it's only good for the same build of resynth.
+#define CHECKPOINT_MAGIC "RSYNCKP5"
+
+typedef struct {
+    char signature[8];
+    int32_t data_width, data_height, depth;
+    int32_t corpus_width, corpus_height, corpus_depth;
+    uint64_t corpus_hash;
+    double autism, polish_target;
+    int32_t h_tile, v_tile, neighbors, tries, magic;
+    int32_t polish, polish_passes;
+    int32_t points, remaining, visits;
+    uint64_t rng[2];
+    int32_t adaptive_tries, tries_samples;
+    int32_t sparse_core, sparse_dilation, dense_passes, sparse_from;
+    double tries_mean, tries_var;
+    // if order_count is set, the points are implicit and aren't saved.
+    uint32_t order_keys[ORDER_ROUNDS];
+    int32_t order_bits, order_count;
+} Checkpoint_header;
+
+static void checkpoint__header(Checkpoint_header *header,
+                               const Resynth_state *s, Parameters parameters) {
+    // (cleared so that the padding is written out consistently)
+    memset(header, 0, sizeof(*header));
+    memcpy(header->signature, CHECKPOINT_MAGIC, sizeof(header->signature));
+    header->data_width = s->data.width;
+    header->data_height = s->data.height;
+    header->depth = s->data.depth;
+    header->corpus_width = s->corpus.width;
+    header->corpus_height = s->corpus.height;
+    header->corpus_depth = s->corpus.depth;
+    header->corpus_hash = hash_bytes(HASH_INIT, s->corpus_array,
+        (size_t)s->corpus.width * s->corpus.height * s->corpus.depth);
+    if (s->exemplar_count > 1) {
+        header->corpus_hash = hash_bytes(header->corpus_hash, s->exemplars,
+            (size_t)s->exemplar_count * sizeof(Exemplar));
+    }
+    header->autism = parameters.autism;
+    header->h_tile = parameters.h_tile;
+    header->v_tile = parameters.v_tile;
+    header->neighbors = parameters.neighbors;
+    header->tries = parameters.tries;
+    header->magic = parameters.magic;
+    header->polish = parameters.polish;
+    header->polish_target = parameters.polish_target;
+    header->polish_passes = parameters.polish_passes;
+    header->adaptive_tries = parameters.adaptive_tries;
+    header->sparse_core = parameters.sparse_core;
+    header->sparse_dilation = parameters.sparse_dilation;
+    header->dense_passes = parameters.dense_passes;
+}
+
+static bool checkpoint__matches(const Checkpoint_header *a,
+                                const Checkpoint_header *b) {
+    return !memcmp(a->signature, b->signature, sizeof(a->signature)) &&
+           a->data_width == b->data_width &&
+           a->data_height == b->data_height &&
+           a->depth == b->depth &&
+           a->corpus_width == b->corpus_width &&
+           a->corpus_height == b->corpus_height &&
+           a->corpus_depth == b->corpus_depth &&
+           a->corpus_hash == b->corpus_hash &&
+           a->autism == b->autism &&
+           a->h_tile == b->h_tile &&
+           a->v_tile == b->v_tile &&
+           a->neighbors == b->neighbors &&
+           a->tries == b->tries &&
+           a->magic == b->magic &&
+           a->polish == b->polish &&
+           a->polish_target == b->polish_target &&
+           a->polish_passes == b->polish_passes &&
+           a->adaptive_tries == b->adaptive_tries &&
+           a->sparse_core == b->sparse_core &&
+           a->sparse_dilation == b->sparse_dilation &&
+           a->dense_passes == b->dense_passes;
+}
+
+static void checkpoint_arm(Resynth_state *s, Parameters parameters) {
+    s->checkpoint_due = 0;
+    if (parameters.checkpoint_path && parameters.checkpoint_interval > 0) {
+        s->checkpoint_due = monotonic_seconds() + parameters.checkpoint_interval;
+    }
+}
+
+static void checkpoint_save(Resynth_state *s, Parameters parameters,
+                            int remaining) {
+    Checkpoint_header header;
+    checkpoint__header(&header, s, parameters);
+    header.points = resynth__count(s);
+    header.remaining = remaining;
+    header.visits = s->visits;
+    header.rng[0] = s->rng.state[0];
+    header.rng[1] = s->rng.state[1];
+    header.tries_samples = s->tries_samples;
+    header.sparse_from = s->sparse_from;
+    header.tries_mean = s->tries_mean;
+    header.tries_var = s->tries_var;
+    memcpy(header.order_keys, s->order.keys, sizeof(header.order_keys));
+    header.order_bits = s->order.bits;
+    header.order_count = s->order.count;
+    const size_t listed = header.order_count ? 0 : header.points;
+
+    // write to a temporary file first, so that being interrupted
+    // while writing never destroys the previous checkpoint.
+    const char *path = parameters.checkpoint_path;
+    char *temp = calloc(strlen(path) + 5, 1);
+    strcat(strcpy(temp, path), ".tmp");
+
+    FILE *f = fopen(temp, "wb");
+    bool ok = f != NULL;
+    const size_t area = (size_t)s->data.width * s->data.height;
+    if (ok) ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    if (ok) ok = fwrite(s->data_array, s->data.depth, area, f) == area;
+    if (ok) ok = fwrite(s->status_array, sizeof(Status), area, f) == area;
+    if (ok) ok = fwrite(s->data_points, sizeof(Coord), listed, f) == listed;
+    if (f && fclose(f)) ok = false;
+    if (ok) ok = rename(temp, path) == 0;
+    if (!ok) fprintf(stderr, "failed to write checkpoint: %s\n", path);
+
+    free(temp);
+}
+
+INLINE void resynth__gather(Resynth_state *s, Parameters parameters,
+                            const Coord position, bool sparse) {
+    // collect neighboring pixels as candidates for best-fit.
+    // the order we check and collect is relevant, thus "sorted_offsets".
+    // a sparse neighborhood has the nearest sparse_core neighbors as usual,
+    // but past those, only takes offsets on a grid sparse_dilation apart,
+    // so the same number of neighbors covers a much larger area.
+    // (the core has to be made of the nearest neighbors that exist,
+    // rather than of the nearest offsets, or else pixels only ever
+    // see each other through the grid while the image is still sparse.)
+    const int core = sparse ? parameters.sparse_core : INT_MAX;
+    const int dilation = parameters.sparse_dilation;
+    s->n_neighbors = 0;
+    const int sorted_offsets_size = sb_count(s->sorted_offsets);
+    for (int j = 0; j < sorted_offsets_size; j++) {
+        const Coord offset = s->sorted_offsets[j];
+        if (s->n_neighbors >= core &&
+            (offset.x % dilation || offset.y % dilation)) continue;
+        Coord point = coord_add(position, offset);
+
+        if (wrap_or_clip(parameters, s->data, &point) &&
+            image_atc(s->status, point)->has_value) {
+            s->neighbors[s->n_neighbors] = offset;
+            s->neighbor_statuses[s->n_neighbors] =
+                image_atc(s->status, point);
+            for (int k = 0; k < s->input_bytes; k++) {
+                s->neighbor_values[s->n_neighbors].v[k] =
+                    image_atc(s->data, point)[k];
+            }
+            s->n_neighbors++;
+            if (s->n_neighbors >= parameters.neighbors) break;
+        }
+    }
+}
+
+// adaptive tries: the random candidates are mostly there to get things
+// started, and to break out of bad patches later on. once enough pixels
+// have been picked to know what a typical match costs, a pixel whose
+// coherent candidates already match better than usual skips them,
+// one that's within a couple of deviations of usual makes do with a
+// quarter of them, and only the rest get the full number.
+// pixels without any coherent candidates always get the full number.
+#define ADAPTIVE_WARMUP 256
+#define ADAPTIVE_WINDOW 1024
+
+static void tries__record(Resynth_state *s, double cost) {
+    // a plain mean and variance at first, then exponentially weighted,
+    // so they can follow the costs as the image fills up.
+    s->tries_samples++;
+    const double weight = 1.0 / MIN(s->tries_samples, ADAPTIVE_WINDOW);
+    const double delta = cost - s->tries_mean;
+    s->tries_mean += weight * delta;
+    s->tries_var += weight * (delta * delta * (1.0 - weight) - s->tries_var);
+}
+
+static int tries__budget(const Resynth_state *s, Parameters parameters,
+                         bool coherent) {
+    if (!parameters.adaptive_tries || !coherent ||
+        s->tries_samples < ADAPTIVE_WARMUP) return parameters.tries;
+    const double cost = resynth__cost(s);
+    if (cost <= s->tries_mean) return 0;
+    if (cost <= s->tries_mean + 2.0 * sqrt(s->tries_var)) {
+        return parameters.tries / 4;
+    }
+    return parameters.tries;
+}
+
+static void resynth__synthesize(Resynth_state *s, Parameters parameters,
+                                int begin, int end) {
+    // (re)synthesize points [begin, end), starting from the end.
+    const int area = corpus_area(s);
+    for (int i = end - 1; i >= begin; i--) {
+        if (!(i & 1023) && (s->checkpoint_due || s->deadline)) {
+            const double now = monotonic_seconds();
+            if (s->deadline && now >= s->deadline) break;
+            if (s->checkpoint_due && now >= s->checkpoint_due) {
+                phase("checkpoint", true);
+                checkpoint_save(s, parameters, i + 1);
+                phase("checkpoint", false);
+                s->checkpoint_due = now + parameters.checkpoint_interval;
             }
         }
 
+        Coord position = resynth__point(s, i);
+        const int visit = s->visits++;
+
+        // this point is guaranteed to have a value after this iteration.
+        image_atc(s->status, position)->has_value = true;
+
+        resynth__gather(s, parameters, position, i >= s->sparse_from);
+
         s->best = INT_MAX;
 
         // consider each neighboring pixel collected as a best-fit.
-        for (int j = 0; j < s->n_neighbors && s->best != 0; j++) {
+        int count = 0;
+        for (int j = 0; j < s->n_neighbors; j++) {
             if (s->neighbor_statuses[j]->has_source) {
                 Coord point = coord_sub(s->neighbor_statuses[j]->source,
                                         s->neighbors[j]);
-                if (point.x < 0 || point.y < 0 ||
-                    point.x >= s->corpus.width || point.y >= s->corpus.height) {
-                    continue;
-                }
+                if (!corpus_has(s, point)) continue;
                 // skip computing differences of points
                 // we've already done this iteration. not mandatory.
-                if (*image_atc(s->tried, point) == i) continue;
-                try_point(s, point);
-                *image_atc(s->tried, point) = i;
+                if (*image_atc(s->tried, point) == visit) continue;
+                *image_atc(s->tried, point) = visit;
+                s->candidates[count++] = point;
             }
         }
+        s->try_kernel(s, s->candidates, count);
+        const int tries = tries__budget(s, parameters, count > 0);
 
         // try some random points in the corpus. this is required for
         // choosing the first couple pixels, since they have no neighbors.
         // after that, this step is optional. it can improve subjective quality.
-        for (int j = 0; j < parameters.tries && s->best != 0; j++) {
-            int random = rnd_pcg_range(&pcg, 0, sb_count(s->corpus_points) - 1);
-            try_point(s, s->corpus_points[random]);
+        // the RNG is saved after every draw, so that if a perfect match
+        // stops the search early, the draws it didn't need can be taken back.
+        // (these aren't checked against the tried array: in a corpus large
+        // enough for it to matter, repeats are rare and the check is
+        // another cache miss. a repeat can't win anyway.)
+        count = 0;
+        for (int j = 0; j < tries && s->best != 0; j++) {
+            const int random = rnd_pcg_range(&s->rng, 0, area - 1);
+            s->candidates[count] = corpus_pixel(s, random);
+            s->candidate_rngs[count++] = s->rng;
         }
+        const int used = s->try_kernel(s, s->candidates, count);
+        if (used < count) s->rng = s->candidate_rngs[used - 1];
 
         // finally, copy the best pixel to the output image.
         for (int j = 0; j < s->input_bytes; j++) {
@@ -415,37 +1150,1264 @@ static void resynth(Resynth_state *s, Parameters parameters) {
         }
         image_atc(s->status, position)->has_source = true;
         image_atc(s->status, position)->source = s->best_point;
+        *image_atc(s->cost, position) = resynth__cost(s);
+        tries__record(s, *image_atc(s->cost, position));
     }
 }
 
-static const int disc00[] = {
-    // http://oeis.org/A057961
-    1,    5,    9,    13,   21,   25,   29,   37,
-    45,   49,   57,   61,   69,   81,   89,   97,
-    101,  109,  113,  121,  129,  137,  145,  149,
-    161,  169,  177,  185,  193,  197,  213,  221,
-    225,  233,  241,  249,  253,  261,  277,  285,
-    293,  301,  305,  317,  325,  333,  341,  349,
-    357,  365,  373,  377,  385,  401,  405,  421,
-    429,  437,  441,  457,  465,  473,  481,  489,
-    497,  505,  509,  517,  529,  545,  553,  561,
-    569,  577,  593,  601,  609,  613,  621,  633,
-    641,  657,  665,  673,  681,  697,  709,  717,
-    725,  733,  741,  749,  757,  761,  769,  777,
-    793,  797,  805,  821,  829,  845,  853,  861,
-    869,  877,  885,  889,  901,  917,  925,  933,
-    941,  949,  965,  973,  981,  989,  997,  1005,
-    1009, 1033, 1041, 1049, 1057, 1069, 1085, 1093
-};
+static void resynth__passes(Resynth_state *s, Parameters parameters, int end) {
+    // synthesizes points [0, end) one pass at a time, so passes show up
+    // in traces. this is the same as synthesizing them all at once.
+    const int *starts = s->order.starts;
+    const int passes = sb_count(starts);
+    char name[32];
+    for (int i = passes; i >= 0; i--) {
+        const int begin = i ? starts[i - 1] : 0;
+        const int stop = MIN(i < passes ? starts[i] : resynth__count(s), end);
+        if (begin >= stop) continue;
+        snprintf(name, sizeof(name), "pass %d", passes - i + 1);
+        phase(name, true);
+        resynth__synthesize(s, parameters, begin, stop);
+        phase(name, false);
+        if (s->deadline && monotonic_seconds() >= s->deadline) break;
+    }
+}
 
-// API Functions
-/* Image and Buffer Loading */
-resynth_state_t
-resynth_state_create_from_image(const char* filename, int desired_channels, int scale) {
-    resynth_state_t s = calloc(1, sizeof(Resynth_state));
-    int w, h, d;
-    uint8_t *image = stbi_load(filename, &w, &h, &d, desired_channels);
-    if (image == NULL) {
+// the energy of a synthesized image is how badly its pixels fit in with
+// their neighbors, measured the way try_point does: each pixel's source is
+// compared against its neighborhood, using the first "neighbors" offsets.
+// it's normalized per neighbor and channel, so 0 is a perfect match
+// and 1 is as different as two pixels can be. pixels without a source
+// count as 1. the tables must have been made by a previous run.
+// if map isn't NULL, each pixel's own energy is written to it as well.
+static double resynth__energy(Resynth_state *s, Parameters parameters,
+                              float *map) {
+    MEMORY(s->neighbors, parameters.neighbors);
+    MEMORY(s->neighbor_values, parameters.neighbors);
+    MEMORY(s->neighbor_statuses, parameters.neighbors);
+
+    // (like synthesis, measuring gives up once the deadline passes, if any)
+    double total = 0;
+    for (int y = 0; y < s->data.height; y++) {
+        if (s->deadline && monotonic_seconds() >= s->deadline) return -1;
+        for (int x = 0; x < s->data.width; x++) {
+            const Coord position = {x, y};
+            const Status *status = image_atc(s->status, position);
+            double energy = 1;
+            if (status->has_source) {
+                resynth__gather(s, parameters, position, false);
+                s->best = INT_MAX;
+                try_point(s, status->source);
+                energy = resynth__cost(s);
+            }
+            if (map) map[y * s->data.width + x] = (float)energy;
+            total += energy;
+        }
+    }
+    return total / MAX(s->data.width * s->data.height, 1);
+}
+
+// worst-first polishing follows the usual passes with a few more that only
+// revisit the pixels that fit in the worst, along with their four neighbors,
+// at most 1/POLISH_WORST_SHARE of the image at a time. this repeats until
+// every pixel's cost is within polish_target, or polish_passes run out.
+// the costs recorded while filling were measured against whatever
+// neighbors existed at the time, so they're measured afresh first;
+// after that, every visit records its own.
+// (a smaller magic plus a couple of these passes tends to match
+// the default magic's energy in about half the time)
+#define POLISH_WORST_SHARE 8
+
+typedef struct {
+    float cost;
+    int index;
+} Polish_rank;
+
+static int polish__compare(const void *v_a, const void *v_b) {
+    // worst first; ties go by index to stay deterministic.
+    const Polish_rank *a = v_a, *b = v_b;
+    if (a->cost != b->cost) return (a->cost < b->cost) - (a->cost > b->cost);
+    return (a->index > b->index) - (a->index < b->index);
+}
+
+static void resynth__polish_worst(Resynth_state *s, Parameters parameters) {
+    if (parameters.polish != RESYNTH_POLISH_WORST) return;
+    const int width = s->data.width;
+    const int area = width * s->data.height;
+    const int budget = MAX(area / POLISH_WORST_SHARE, 1);
+    phase("energy", true);
+    resynth__energy(s, parameters, s->cost_array);
+    phase("energy", false);
+
+    s->sparse_from = INT_MAX;
+    char name[32];
+    Polish_rank *ranks = calloc(area, sizeof(Polish_rank));
+    int *queued = calloc(area, sizeof(int));
+    for (int pass = 1; pass <= parameters.polish_passes; pass++) {
+        int worse = 0;
+        for (int i = 0; i < area; i++) {
+            if (queued[i] < 0) continue;
+            if (s->cost_array[i] <= parameters.polish_target) continue;
+            ranks[worse].cost = s->cost_array[i];
+            ranks[worse].index = i;
+            worse++;
+        }
+        if (!worse) break;
+        qsort(ranks, worse, sizeof(Polish_rank), polish__compare);
+
+        points__clear(s);
+        int centers = 0;
+        for (; centers < worse && sb_count(s->data_points) < budget; centers++) {
+            const int i = centers;
+            const Coord center = {ranks[i].index % width, ranks[i].index / width};
+            const Coord around[] = {{0, 0}, {1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+            for (int j = 0; j < (int)LEN(around); j++) {
+                Coord point = coord_add(center, around[j]);
+                if (!wrap_or_clip(parameters, s->data, &point)) continue;
+                int *stamp = &queued[point.y * width + point.x];
+                if (*stamp == pass || *stamp < 0) continue;
+                *stamp = pass;
+                sb_push(s->data_points, point);
+            }
+        }
+        shuffle_points(&s->rng, s->data_points, sb_count(s->data_points));
+        snprintf(name, sizeof(name), "worst pass %d", pass);
+        phase(name, true);
+        resynth__synthesize(s, parameters, 0, resynth__count(s));
+        phase(name, false);
+
+        // pixels that couldn't do any better won't get better next time either;
+        // leave them be, so the budget goes to the others.
+        for (int i = 0; i < centers; i++) {
+            if (s->cost_array[ranks[i].index] >= ranks[i].cost) {
+                queued[ranks[i].index] = -1;
+            }
+        }
+    }
+    free(ranks);
+    free(queued);
+}
+
+static void resynth(Resynth_state *s, Parameters parameters) {
+    // "resynthesize" an output image from a given input image.
+    if (!resynth__init(s, parameters)) return;
+    checkpoint_arm(s, parameters);
+    resynth__passes(s, parameters, resynth__count(s));
+    s->checkpoint_due = 0;
+    resynth__polish_worst(s, parameters);
+}
+
+// detached results keep the state's output buffer, and the state takes
+// another one from a list of spares, which freed results give theirs back
+// to. after a couple of runs, that's just two buffers trading places.
+// the spares are shared by the state and its results, since either may be
+// freed first, and results may be freed on any thread.
+typedef struct Buffers {
+    pthread_mutex_t lock;
+    int refs;
+    Pixel **free; // (stretchy buffer)
+} Buffers;
+
+static Buffers *buffers_create(void) {
+    Buffers *buffers = calloc(1, sizeof(Buffers));
+    pthread_mutex_init(&buffers->lock, NULL);
+    buffers->refs = 1;
+    return buffers;
+}
+
+static void buffers_release(Buffers *buffers) {
+    pthread_mutex_lock(&buffers->lock);
+    const bool last = --buffers->refs == 0;
+    pthread_mutex_unlock(&buffers->lock);
+    if (!last) return;
+    for (int i = 0; i < sb_count(buffers->free); i++) free(buffers->free[i]);
+    sb_freeset(buffers->free);
+    pthread_mutex_destroy(&buffers->lock);
+    free(buffers);
+}
+
+static void buffers_give(Buffers *buffers, Pixel *buffer) {
+    pthread_mutex_lock(&buffers->lock);
+    sb_push(buffers->free, buffer);
+    pthread_mutex_unlock(&buffers->lock);
+    buffers_release(buffers);
+}
+
+static void state__reclaim(Resynth_state *s) {
+    // gives the state buffers of its own again, if its last result took them.
+    if (!s->lent) return;
+    Pixel *buffer = NULL;
+    pthread_mutex_lock(&s->buffers->lock);
+    if (sb_count(s->buffers->free) > 0) {
+        buffer = sb_last(s->buffers->free);
+        stb__sbn(s->buffers->free)--;
+    }
+    pthread_mutex_unlock(&s->buffers->lock);
+
+    s->data_array = buffer ? buffer :
+        calloc(s->data.width * s->data.height * s->data.depth, sizeof(Pixel));
+    // statuses are cleared for every run anyway.
+    s->status_array = NULL;
+    s->status.width = s->status.height = 0;
+    s->warm = false;
+    s->lent = false;
+}
+
+static void result__detach(Resynth_result *result, Resynth_state *s) {
+    if (s->ownership != RESYNTH_RESULT_DETACHED) return;
+    if (!result->valid || result->pixels != s->data_array) return;
+    if (s->buffers == NULL) s->buffers = buffers_create();
+    pthread_mutex_lock(&s->buffers->lock);
+    s->buffers->refs++;
+    pthread_mutex_unlock(&s->buffers->lock);
+    result->buffers = s->buffers;
+    s->lent = true;
+}
+
+static void result_from_state(Resynth_result *result, const Resynth_state *state) {
+    result->pixels = state->data_array;
+    result->status = state->status_array;
+    result->width = state->data.width;
+    result->height = state->data.height;
+    result->channels = state->data.depth;
+    result->energy = -1;
+    result->valid = true;
+}
+
+static bool checkpoint_load(Resynth_state *s, Parameters parameters,
+                            const char *path) {
+    // the state must have been made from the same corpus, at the same size,
+    // and the parameters must match. the seed doesn't matter anymore.
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "failed to open checkpoint: %s\n", path);
+        return false;
+    }
+
+    Checkpoint_header header, expected;
+    checkpoint__header(&expected, s, parameters);
+    bool ok = fread(&header, sizeof(header), 1, f) == 1;
+    if (ok) {
+        ok = checkpoint__matches(&header, &expected) &&
+             header.remaining >= 0 && header.remaining <= header.points;
+        if (!ok) fprintf(stderr, "checkpoint doesn't match: %s\n", path);
+    }
+
+    if (ok) ok = resynth__tables(s, parameters);
+    if (ok) {
+        resynth__work(s, parameters);
+        const size_t area = (size_t)s->data.width * s->data.height;
+        const int listed = header.order_count ? 0 : header.points;
+        points__clear(s);
+        Coord *points = listed ? sb_add(s->data_points, listed) : NULL;
+        ok = fread(s->data_array, s->data.depth, area, f) == area &&
+             fread(s->status_array, sizeof(Status), area, f) == area &&
+             fread(points, sizeof(Coord), listed, f) == (size_t)listed;
+        if (!ok) fprintf(stderr, "truncated checkpoint: %s\n", path);
+    }
+    if (ok) {
+        memcpy(s->order.keys, header.order_keys, sizeof(s->order.keys));
+        s->order.bits = header.order_bits;
+        s->order.count = header.order_count;
+        if (s->order.count) order__passes(s, parameters);
+        ok = resynth__count(s) == header.points;
+        if (!ok) fprintf(stderr, "checkpoint doesn't match: %s\n", path);
+    }
+    fclose(f);
+    if (!ok) return false;
+
+    s->rng.state[0] = header.rng[0];
+    s->rng.state[1] = header.rng[1];
+    s->visits = header.visits;
+    s->tries_samples = header.tries_samples;
+    s->sparse_from = header.sparse_from;
+    s->tries_mean = header.tries_mean;
+    s->tries_var = header.tries_var;
+
+    checkpoint_arm(s, parameters);
+    resynth__passes(s, parameters, header.remaining);
+    s->checkpoint_due = 0;
+    resynth__polish_worst(s, parameters);
+    return true;
+}
+
+// a child state synthesizes an image of its own from the same corpus,
+// borrowing the parent's corpus and tables. each child gets its own RNG stream,
+// so children can run concurrently and still be deterministic.
+static void resynth__child(Resynth_state *t, const Resynth_state *s,
+                           int width, int height,
+                           Parameters parameters, int stream) {
+    memset(t, 0, sizeof(*t));
+    t->parent = s;
+    t->input_bytes = s->input_bytes;
+    t->corpus = s->corpus;
+    t->corpus_array = s->corpus_array;
+    t->exemplars = s->exemplars;
+    t->exemplar_columns = s->exemplar_columns;
+    t->exemplar_count = s->exemplar_count;
+    t->exemplar_area = s->exemplar_area;
+    t->sorted_offsets = s->sorted_offsets;
+    t->diff_table = s->diff_table;
+    IMAGE_RESIZE(t->data, width, height, s->input_bytes);
+    rnd_pcg_seed(&t->rng, (uint32_t)parameters.random_seed +
+                          0x9E3779B9u * (uint32_t)(stream + 1));
+    resynth__work(t, parameters);
+}
+
+static void resynth__fill(Resynth_state *s, Parameters parameters) {
+    // synthesize every pixel without a value, around the ones with one.
+    resynth__points(s, parameters);
+    resynth__passes(s, parameters, resynth__count(s));
+    resynth__polish_worst(s, parameters);
+}
+
+static void resynth__copy(Resynth_state *to, int to_x, int to_y,
+                          const Resynth_state *from, int from_x, int from_y,
+                          int width, int height) {
+    // copy pixels along with their statuses between states.
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            memcpy(image_at(to->data, (to_x + x), (to_y + y)),
+                   image_at(from->data, (from_x + x), (from_y + y)),
+                   to->input_bytes);
+            *image_at(to->status, (to_x + x), (to_y + y)) =
+                *image_at(from->status, (from_x + x), (from_y + y));
+        }
+    }
+}
+
+// anytime runs make a coarse image as quickly as possible,
+// with a small neighborhood, a handful of random tries and no polishing,
+// at a fraction of the output size (at most ANYTIME_COARSE_AREA pixels).
+// its source map is scaled up into a warm start, each coarse pixel
+// becoming a block copied from around its source, which is the preview.
+// that's then refined in warm-started passes with the actual parameters
+// until the deadline passes or a pass stops paying off.
+// the preview and every pass that lowers the energy are handed to the
+// progress callback. measuring stops at the deadline, like synthesis,
+// and a pass that couldn't be measured in time is dropped, so the result
+// only goes unmeasured (with a negative energy) if the preview was.
+// the preview takes a copy per output pixel, so with outputs of millions
+// of pixels it may still arrive some tens of milliseconds late.
+#define ANYTIME_NEIGHBORS 9
+#define ANYTIME_TRIES 16
+#define ANYTIME_CONVERGED 0.001
+#define ANYTIME_COARSE_AREA (128 * 128)
+
+static void anytime__coarse(Resynth_state *s, Parameters coarse,
+                            double deadline) {
+    // fills in every pixel of s, with a source.
+    const int width = s->data.width, height = s->data.height;
+    int shrink = 1;
+    while ((double)width * height > (double)shrink * shrink * ANYTIME_COARSE_AREA) {
+        shrink++;
+    }
+
+    Resynth_state child;
+    Resynth_state *t = &child;
+    resynth__child(t, s, (width + shrink - 1) / shrink,
+                   (height + shrink - 1) / shrink, coarse, 0);
+    t->deadline = deadline;
+    resynth__fill(t, coarse);
+
+    // block by block, so that each coarse pixel is only looked at once.
+    // (pixels the deadline left without a source get a random one)
+    for (int cy = 0; cy < t->data.height; cy++) {
+        for (int cx = 0; cx < t->data.width; cx++) {
+            const Status *from = image_at(t->status, cx, cy);
+            const Coord random = from->has_source ? from->source :
+                corpus_pixel(s, rnd_pcg_range(&s->rng, 0, corpus_area(s) - 1));
+            const int x0 = cx * shrink, y0 = cy * shrink;
+            for (int y = y0; y < MIN(y0 + shrink, height); y++) {
+                for (int x = x0; x < MIN(x0 + shrink, width); x++) {
+                    Coord source = random;
+                    const Coord offset = {x - x0, y - y0};
+                    if (from->has_source && corpus_has(s, coord_add(source, offset))) {
+                        source = coord_add(source, offset);
+                    }
+                    Status *status = image_at(s->status, x, y);
+                    status->has_value = true;
+                    status->has_source = true;
+                    status->source = source;
+                    memcpy(image_at(s->data, x, y), image_atc(s->corpus, source),
+                           s->input_bytes);
+                }
+            }
+        }
+    }
+    state_free(t);
+}
+
+static void resynth_anytime(Resynth_state *s, Parameters parameters,
+                            double deadline, Resynth_result *result,
+                            resynth_progress_t progress, void *user) {
+    Parameters coarse = parameters;
+    coarse.neighbors = MIN(parameters.neighbors, ANYTIME_NEIGHBORS);
+    coarse.tries = MIN(parameters.tries, ANYTIME_TRIES);
+    coarse.magic = 0;
+    coarse.polish = RESYNTH_POLISH_MAGIC;
+    // (the diff table and offsets are the same for both)
+    if (!resynth__tables(s, parameters)) return;
+    s->warm = false;
+    resynth__work(s, parameters);
+    phase("coarse", true);
+    anytime__coarse(s, coarse, deadline);
+    phase("coarse", false);
+
+    // the preview is handed over before it's measured, which takes a while.
+    result_from_state(result, s);
+    if (progress) progress(user, result);
+    s->deadline = deadline;
+    result->energy = resynth__energy(s, parameters, NULL);
+    s->deadline = 0;
+    if (result->energy < 0) return;
+
+    // keep the best image around, in case a pass makes things worse.
+    const size_t area = (size_t)s->data.width * s->data.height;
+    Pixel *best_data = malloc(area * s->data.depth);
+    Status *best_status = malloc(area * sizeof(Status));
+    memcpy(best_data, s->data_array, area * s->data.depth);
+    memcpy(best_status, s->status_array, area * sizeof(Status));
+
+    while (monotonic_seconds() < deadline) {
+        s->warm = true;
+        resynth__work(s, parameters);
+        resynth__refine_points(s, parameters);
+        s->warm = false;
+
+        s->deadline = deadline;
+        resynth__passes(s, parameters, resynth__count(s));
+        const double energy = resynth__energy(s, parameters, NULL);
+        s->deadline = 0;
+
+        // a pass that the deadline cut short, or left unmeasured,
+        // can't be compared, so the last measured image is kept instead.
+        if (energy < 0 || energy >= result->energy) {
+            memcpy(s->data_array, best_data, area * s->data.depth);
+            memcpy(s->status_array, best_status, area * sizeof(Status));
+            break;
+        }
+        const bool converged =
+            energy > result->energy * (1.0 - ANYTIME_CONVERGED);
+        result->energy = energy;
+        memcpy(best_data, s->data_array, area * s->data.depth);
+        memcpy(best_status, s->status_array, area * sizeof(Status));
+        if (progress) progress(user, result);
+        if (converged) break;
+    }
+
+    free(best_data);
+    free(best_status);
+    assert(result->energy >= 0);
+}
+
+// the built-in executor is a pool of detached worker threads shared by
+// everything in the process. it starts out empty and grows to the largest
+// number of threads asked for so far. waiting on a group runs that group's
+// queued tasks on the waiting thread, so that a task can wait on a group
+// of its own without tying up a worker.
+typedef struct Pool_group {
+    int pending;
+} Pool_group;
+
+typedef struct Pool_task {
+    void (*fn)(void *arg);
+    void *arg;
+    Pool_group *group;
+    struct Pool_task *next;
+} Pool_task;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    Pool_task *head, *tail;
+    int workers;
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+          PTHREAD_COND_INITIALIZER, NULL, NULL, 0};
+
+static Pool_task *pool__take(Pool_group *group) {
+    // removes the first queued task (of the given group, if any).
+    // the lock must be held.
+    Pool_task **link = &pool.head, *previous = NULL;
+    while (*link && group && (*link)->group != group) {
+        previous = *link;
+        link = &(*link)->next;
+    }
+    Pool_task *task = *link;
+    if (task == NULL) return NULL;
+    *link = task->next;
+    if (pool.tail == task) pool.tail = previous;
+    return task;
+}
+
+static void pool__run(Pool_task *task) {
+    // runs a task taken from the queue. the lock must be held.
+    pthread_mutex_unlock(&pool.lock);
+    task->fn(task->arg);
+    pthread_mutex_lock(&pool.lock);
+    if (--task->group->pending == 0) pthread_cond_broadcast(&pool.done);
+    free(task);
+}
+
+static void *pool__worker(void *unused) {
+    (void)unused;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        Pool_task *task = pool__take(NULL);
+        if (task) pool__run(task);
+        else pthread_cond_wait(&pool.work, &pool.lock);
+    }
+    return NULL;
+}
+
+// forked children (like worker processes) start out without the pool's
+// threads, and must not write into their parent's trace. the trace is
+// flushed before forking, so closing the child's copy writes nothing.
+static void fork__prepare(void) {
+    pthread_mutex_lock(&tracing.lock);
+    if (tracing.file) fflush(tracing.file);
+    pthread_mutex_lock(&pool.lock);
+}
+
+static void fork__parent(void) {
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&tracing.lock);
+}
+
+static void fork__child(void) {
+    pool.head = pool.tail = NULL;
+    pool.workers = 0;
+    pthread_cond_init(&pool.work, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    pthread_mutex_unlock(&pool.lock);
+    if (tracing.file) fclose(tracing.file);
+    tracing.file = NULL;
+    tracing__update();
+    pthread_mutex_unlock(&tracing.lock);
+}
+
+static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+
+static void fork__register(void) {
+    pthread_atfork(fork__prepare, fork__parent, fork__child);
+}
+
+static void pool__reserve(int workers) {
+    pthread_once(&fork_once, fork__register);
+    pthread_mutex_lock(&pool.lock);
+    while (pool.workers < workers) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool__worker, NULL)) break;
+        pthread_detach(thread);
+        pool.workers++;
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static void *pool_group(void *user) {
+    (void)user;
+    return calloc(1, sizeof(Pool_group));
+}
+
+static void pool_submit(void *user, void *group,
+                        void (*fn)(void *arg), void *arg) {
+    (void)user;
+    Pool_task *task = calloc(1, sizeof(Pool_task));
+    task->fn = fn;
+    task->arg = arg;
+    task->group = group;
+    pthread_mutex_lock(&pool.lock);
+    task->group->pending++;
+    if (pool.tail) pool.tail->next = task;
+    else pool.head = task;
+    pool.tail = task;
+    pthread_cond_signal(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static void pool_wait(void *user, void *group) {
+    (void)user;
+    Pool_group *g = group;
+    pthread_mutex_lock(&pool.lock);
+    while (g->pending) {
+        Pool_task *task = pool__take(g);
+        if (task) pool__run(task);
+        else pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    free(g);
+}
+
+static const resynth_executor_t builtin_executor = {
+    NULL, 0, pool_group, pool_submit, pool_wait
+};
+
+static int resolve_threads(int threads) {
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return MAX(threads, 1);
+}
+
+static int parallel_threads(Parameters parameters) {
+    // the threads parameter, or else whatever the executor says, or else
+    // one per core.
+    if (parameters.threads > 0) return parameters.threads;
+    return resolve_threads(parameters.executor.threads);
+}
+
+static void parallel_prepare(Parameters parameters, int tasks) {
+    // makes sure the built-in pool has workers for that many tasks.
+    if (parameters.executor.submit == pool_submit) pool__reserve(tasks);
+}
+
+// runs fn(arg, i) for every i in [0, count) as tasks on the executor,
+// on up to parallel_threads threads, the calling thread included.
+// each one is traced as a phase of the given name.
+typedef struct {
+    void (*fn)(void *arg, int index);
+    void *arg;
+    int count;
+    atomic_int next;
+    const char *name; // of each index, for tracing
+} Parallel_job;
+
+static void parallel__worker(void *arg) {
+    Parallel_job *job = arg;
+    for (;;) {
+        int index = atomic_fetch_add(&job->next, 1);
+        if (index >= job->count) break;
+        phase(job->name, true);
+        job->fn(job->arg, index);
+        phase(job->name, false);
+    }
+}
+
+static void parallel_for(int count, Parameters parameters, const char *name,
+                         void (*fn)(void *arg, int index), void *arg) {
+    Parallel_job job = {.fn = fn, .arg = arg, .count = count};
+    job.name = name;
+    atomic_init(&job.next, 0);
+
+    const resynth_executor_t *executor = &parameters.executor;
+    const int helpers = MIN(parallel_threads(parameters), MAX(count, 1)) - 1;
+    parallel_prepare(parameters, helpers);
+
+    void *group = executor->group_create(executor->user);
+    for (int i = 0; i < helpers; i++) {
+        executor->submit(executor->user, group, parallel__worker, &job);
+    }
+    parallel__worker(&job);
+    executor->wait(executor->user, group);
+}
+
+// tiled synthesis splits the output into tile_size squares which are
+// synthesized independently (and concurrently), each with its own RNG stream.
+// the tiles don't know about each other, so a serial seam pass then clears
+// a band of tile_overlap pixels on either side of every tile edge
+// and resynthesizes it with the tiles as fixed context.
+// this scales with cores, but structures larger than a tile are lost,
+// and the seam bands are only as coherent as a single-pass synthesis.
+typedef struct {
+    Resynth_state *s;
+    Parameters parameters;
+} Tile_job;
+
+static int tile__columns(const Resynth_state *s, Parameters parameters) {
+    return (s->data.width + parameters.tile_size - 1) / parameters.tile_size;
+}
+
+static int tile__count(const Resynth_state *s, Parameters parameters) {
+    const int size = parameters.tile_size;
+    if (size <= 0 || (s->data.width <= size && s->data.height <= size)) return 0;
+    return tile__columns(s, parameters) * ((s->data.height + size - 1) / size);
+}
+
+static Coord tile__fill(Resynth_state *t, const Resynth_state *s,
+                        Parameters parameters, int index) {
+    // synthesizes a tile into the child state t, returning where it goes.
+    const int size = parameters.tile_size;
+    const int columns = tile__columns(s, parameters);
+    const Coord at = {index % columns * size, index / columns * size};
+
+    // tiles can't wrap onto themselves; the seam pass handles that.
+    parameters.h_tile = false;
+    parameters.v_tile = false;
+
+    resynth__child(t, s, MIN(size, s->data.width - at.x),
+                   MIN(size, s->data.height - at.y), parameters, index);
+    resynth__fill(t, parameters);
+    return at;
+}
+
+static void resynth__tile(void *arg, int index) {
+    Tile_job *job = arg;
+    Resynth_state tile;
+    Resynth_state *t = &tile;
+    const Coord at = tile__fill(t, job->s, job->parameters, index);
+
+    // tiles never overlap, so no locking is needed to copy them back.
+    resynth__copy(job->s, at.x, at.y, t, 0, 0, t->data.width, t->data.height);
+    state_free(t);
+}
+
+static void resynth__seam_mask(bool *mask, int size, int tile_size,
+                               int overlap, bool wrap) {
+    // marks everything within overlap pixels of a tile edge along one axis.
+    // the outer edge only counts as a tile edge when the output wraps.
+    for (int edge = wrap ? 0 : tile_size; edge < size; edge += tile_size) {
+        for (int k = -overlap; k < overlap; k++) {
+            int i = edge + k;
+            if (wrap) i = (i % size + size) % size;
+            else if (i < 0 || i >= size) continue;
+            mask[i] = true;
+        }
+    }
+}
+
+static void resynth__seams(Resynth_state *s, Parameters parameters) {
+    // clear the seam bands and fill them back in.
+    const int size = parameters.tile_size;
+    bool *columns = calloc(s->data.width, sizeof(bool));
+    bool *seam_rows = calloc(s->data.height, sizeof(bool));
+    resynth__seam_mask(columns, s->data.width, size,
+                       parameters.tile_overlap, parameters.h_tile);
+    resynth__seam_mask(seam_rows, s->data.height, size,
+                       parameters.tile_overlap, parameters.v_tile);
+    for (int y = 0; y < s->data.height; y++) {
+        for (int x = 0; x < s->data.width; x++) {
+            if (!columns[x] && !seam_rows[y]) continue;
+            image_at(s->status, x, y)->has_value = false;
+            image_at(s->status, x, y)->has_source = false;
+        }
+    }
+    free(columns);
+    free(seam_rows);
+
+    phase("seams", true);
+    resynth__fill(s, parameters);
+    phase("seams", false);
+}
+
+static void resynth_tiled(Resynth_state *s, Parameters parameters) {
+    if (!resynth__tables(s, parameters)) return;
+    resynth__work(s, parameters);
+
+    Tile_job job = {s, parameters};
+    parallel_for(tile__count(s, parameters), parameters, "tile",
+                 resynth__tile, &job);
+    resynth__seams(s, parameters);
+}
+
+// autotuning runs trial syntheses from a crop of the corpus with combinations
+// of the settings below, and picks the cheapest one that reaches the target
+// energy, or the best one if none of them do. trials are run in batches,
+// roughly from cheapest to most expensive, until a batch reaches the target.
+// since they run concurrently, each is timed by the CPU time of its thread.
+// all energies are measured with the same neighborhood to be comparable.
+#define AUTOTUNE_CROP 48
+#define AUTOTUNE_SCALE 2
+#define AUTOTUNE_REFERENCE 29
+
+static const int autotune_neighbors[] = {9, 13, 21, 29, 45};
+static const int autotune_tries[] = {16, 48, 96, 192};
+static const int autotune_magic[] = {0, 128, 192};
+
+typedef struct {
+    const Resynth_state *crop;
+    Parameters parameters;
+    resynth_tuning_t *trials;
+    int first;
+} Autotune_job;
+
+static double autotune__estimate(const resynth_tuning_t *trial) {
+    // candidates per pixel, times neighbors per candidate, times visits.
+    return (double)(trial->tries + trial->neighbors) * trial->neighbors /
+           (1.0 - trial->magic / 256.0);
+}
+
+static int autotune__compare(const void *v_a, const void *v_b) {
+    const double a = autotune__estimate(v_a), b = autotune__estimate(v_b);
+    return (a > b) - (a < b);
+}
+
+static void autotune__trial(void *arg, int index) {
+    Autotune_job *job = arg;
+    resynth_tuning_t *trial = &job->trials[job->first + index];
+    Parameters parameters = job->parameters;
+    parameters.neighbors = trial->neighbors;
+    parameters.tries = trial->tries;
+    parameters.magic = trial->magic;
+
+    // every trial uses the same random stream, to compare like with like.
+    Resynth_state state;
+    Resynth_state *t = &state;
+    resynth__child(t, job->crop, job->crop->data.width,
+                   job->crop->data.height, parameters, 0);
+    const double start = thread_seconds();
+    resynth__fill(t, parameters);
+    trial->seconds_per_pixel = (thread_seconds() - start) /
+                               (t->data.width * t->data.height);
+
+    parameters.neighbors = AUTOTUNE_REFERENCE;
+    trial->energy = resynth__energy(t, parameters, NULL);
+    state_free(t);
+}
+
+static bool autotune(const Resynth_state *s, Parameters parameters,
+                     double target, resynth_tuning_t *choice) {
+    // (from the first exemplar, when there are several)
+    const Exemplar e = exemplar_of(s, 0);
+    const int w = MIN(e.width, AUTOTUNE_CROP);
+    const int h = MIN(e.height, AUTOTUNE_CROP);
+    const int x0 = e.x + (e.width - w) / 2, y0 = (e.height - h) / 2;
+
+    Resynth_state crop = {0};
+    crop.input_bytes = s->input_bytes;
+    IMAGE_RESIZE(crop.corpus, w, h, s->corpus.depth);
+    for (int y = 0; y < h; y++) {
+        memcpy(image_at(crop.corpus, 0, y), image_at(s->corpus, x0, (y0 + y)),
+               (size_t)w * s->corpus.depth);
+    }
+    IMAGE_RESIZE(crop.data, w * AUTOTUNE_SCALE, h * AUTOTUNE_SCALE,
+                 s->input_bytes);
+    parameters.h_tile = true;
+    parameters.v_tile = true;
+    if (!resynth__tables(&crop, parameters)) {
+        state_free(&crop);
+        return false;
+    }
+
+    const int count = LEN(autotune_neighbors) * LEN(autotune_tries) *
+                      LEN(autotune_magic);
+    Autotune_job job = {.crop = &crop, .parameters = parameters};
+    job.trials = calloc(count, sizeof(resynth_tuning_t));
+    for (int i = 0; i < count; i++) {
+        job.trials[i].neighbors = autotune_neighbors[i % LEN(autotune_neighbors)];
+        job.trials[i].tries = autotune_tries[i / LEN(autotune_neighbors) %
+                                             LEN(autotune_tries)];
+        job.trials[i].magic = autotune_magic[i / LEN(autotune_neighbors) /
+                                             LEN(autotune_tries)];
+    }
+    qsort(job.trials, count, sizeof(resynth_tuning_t), autotune__compare);
+
+    const int batch = MAX(parallel_threads(parameters), 4);
+    int best = -1, cheapest = -1;
+    while (job.first < count && cheapest < 0) {
+        const int n = MIN(batch, count - job.first);
+        parallel_for(n, parameters, "trial", autotune__trial, &job);
+        for (int i = job.first; i < job.first + n; i++) {
+            const resynth_tuning_t *trial = &job.trials[i];
+            if (best < 0 || trial->energy < job.trials[best].energy) best = i;
+            if (trial->energy <= target && (cheapest < 0 ||
+                trial->seconds_per_pixel <
+                job.trials[cheapest].seconds_per_pixel)) {
+                cheapest = i;
+            }
+        }
+        job.first += n;
+    }
+    *choice = job.trials[cheapest >= 0 ? cheapest : best];
+
+    free(job.trials);
+    state_free(&crop);
+    return cheapest >= 0;
+}
+
+// image quilting (Efros & Freeman, 2001) stitches whole patches of the corpus
+// together instead of choosing pixels one at a time. patches are laid out
+// in raster order with patch_overlap pixels shared between neighbors.
+// each patch is picked among "tries" random candidates by its error
+// over the pixels already filled in, and is then joined to them
+// along minimum-error boundary cuts through the overlapping bands.
+// this is a lot cheaper per output pixel, but works best
+// on stochastic textures without much large-scale structure.
+#define QUILT_TOLERANCE 0.1
+
+static void quilt__cut(const int *errors, int length, int width, int *cut) {
+    // find the cheapest path through a length * width band of errors,
+    // moving at most one step sideways per row. cut[i] is the path's column.
+    int *cost = calloc(length * width, sizeof(int));
+    for (int k = 0; k < width; k++) cost[k] = errors[k];
+    for (int i = 1; i < length; i++) {
+        for (int k = 0; k < width; k++) {
+            int best = cost[(i - 1) * width + k];
+            if (k > 0) best = MIN(best, cost[(i - 1) * width + k - 1]);
+            if (k < width - 1) best = MIN(best, cost[(i - 1) * width + k + 1]);
+            cost[i * width + k] = best + errors[i * width + k];
+        }
+    }
+
+    int k = 0;
+    for (int j = 1; j < width; j++) {
+        if (cost[(length - 1) * width + j] < cost[(length - 1) * width + k]) k = j;
+    }
+    cut[length - 1] = k;
+    for (int i = length - 2; i >= 0; i--) {
+        int next = k;
+        if (k > 0 && cost[i * width + k - 1] < cost[i * width + next]) next = k - 1;
+        if (k < width - 1 && cost[i * width + k + 1] < cost[i * width + next]) next = k + 1;
+        k = next;
+        cut[i] = k;
+    }
+    free(cost);
+}
+
+INLINE int64_t quilt__error(Resynth_state *s, Parameters parameters,
+                            const Coord position, const Coord source, int size,
+                            int64_t bound) {
+    // sum up the differences between a candidate patch at source
+    // and whatever has already been filled in at position.
+    int64_t sum = 0;
+    for (int dy = 0; dy < size; dy++) {
+        for (int dx = 0; dx < size; dx++) {
+            Coord point = {position.x + dx, position.y + dy};
+            if (!wrap_or_clip(parameters, s->data, &point)) continue;
+            if (!image_atc(s->status, point)->has_value) continue;
+            const Pixel *data_pixel = image_atc(s->data, point);
+            const Pixel *corpus_pixel =
+                image_at(s->corpus, (source.x + dx), (source.y + dy));
+            for (int j = 0; j < s->input_bytes; j++) {
+                sum += s->diff_table[256 + data_pixel[j] - corpus_pixel[j]];
+            }
+        }
+        if (sum > bound) return sum;
+    }
+    return sum;
+}
+
+static Coord quilt__source(Resynth_state *s, int size) {
+    // a random patch, from within one exemplar.
+    if (s->exemplar_count <= 1) {
+        return (Coord){
+            rnd_pcg_range(&s->rng, 0, s->corpus.width - size),
+            rnd_pcg_range(&s->rng, 0, s->corpus.height - size),
+        };
+    }
+    const int random = rnd_pcg_range(&s->rng, 0, corpus_area(s) - 1);
+    const Exemplar e = exemplar_of(s, corpus_pixel(s, random).x);
+    return (Coord){
+        e.x + rnd_pcg_range(&s->rng, 0, e.width - size),
+        rnd_pcg_range(&s->rng, 0, e.height - size),
+    };
+}
+
+static void quilt(Resynth_state *s, Parameters parameters) {
+    int smallest = MIN(s->corpus.width, s->corpus.height);
+    for (int i = 0; i < s->exemplar_count; i++) {
+        smallest = MIN(smallest, MIN(s->exemplars[i].width, s->exemplars[i].height));
+    }
+    const int size = MIN(parameters.patch_size, smallest);
+    const int overlap = MIN(parameters.patch_overlap, size - 1);
+    const int step = size - overlap;
+
+    if (size < 1 || !s->data.width || !s->data.height) {
+        fprintf(stderr, "invalid sizes\n");
+        return;
+    }
+
+    make_diff_table(s, parameters);
+    IMAGE_RESIZE(s->status, s->data.width, s->data.height, 1);
+
+    const int tries = MAX(parameters.tries, 1);
+    Coord *candidates = calloc(tries, sizeof(Coord));
+    int64_t *candidate_errors = calloc(tries, sizeof(int64_t));
+    int *errors = calloc(size * size, sizeof(int));
+    int *band = calloc(size * MAX(overlap, 1), sizeof(int));
+    int *cuts[4];
+    bool use_cut[4]; // left, top, right, bottom
+    for (int k = 0; k < 4; k++) cuts[k] = calloc(size, sizeof(int));
+
+    // with wrapping, the last patch of a row overlaps the first one instead
+    // of the image edge. otherwise, patches past the edge are clipped.
+    for (int y = 0; y < s->data.height;) {
+        for (int x = 0; x < s->data.width;) {
+            const Coord position = {x, y};
+
+            // pick a random candidate among those that fit well enough.
+            int64_t best = INT64_MAX;
+            for (int j = 0; j < tries; j++) {
+                const Coord source = quilt__source(s, size);
+                int64_t bound = best == INT64_MAX ? INT64_MAX :
+                                (int64_t)(best * (1.0 + QUILT_TOLERANCE));
+                candidates[j] = source;
+                candidate_errors[j] = quilt__error(s, parameters, position,
+                                                   source, size, bound);
+                if (candidate_errors[j] < best) best = candidate_errors[j];
+            }
+            const int64_t limit = (int64_t)(best * (1.0 + QUILT_TOLERANCE));
+            int n = 0;
+            for (int j = 0; j < tries; j++) {
+                if (candidate_errors[j] <= limit) candidates[n++] = candidates[j];
+            }
+            const Coord source = candidates[rnd_pcg_range(&s->rng, 0, n - 1)];
+
+            // per-pixel errors against what's already there.
+            for (int k = 0; k < 4; k++) use_cut[k] = false;
+            for (int dy = 0; dy < size; dy++) {
+                for (int dx = 0; dx < size; dx++) {
+                    int *error = &errors[dy * size + dx];
+                    *error = 0;
+                    Coord point = {x + dx, y + dy};
+                    if (!wrap_or_clip(parameters, s->data, &point)) continue;
+                    if (!image_atc(s->status, point)->has_value) continue;
+                    const Pixel *data_pixel = image_atc(s->data, point);
+                    const Pixel *corpus_pixel =
+                        image_at(s->corpus, (source.x + dx), (source.y + dy));
+                    for (int j = 0; j < s->input_bytes; j++) {
+                        *error += s->diff_table[256 + data_pixel[j] - corpus_pixel[j]];
+                    }
+                    if (dx == 0) use_cut[0] = true;
+                    if (dy == 0) use_cut[1] = true;
+                    if (dx == size - 1) use_cut[2] = true;
+                    if (dy == size - 1) use_cut[3] = true;
+                }
+            }
+
+            // cut through each overlapping band. the cuts run from the
+            // patch's outer edge inwards, so that cut[i] == 0 keeps nothing.
+            if (overlap > 0) for (int k = 0; k < 4; k++) {
+                if (!use_cut[k]) continue;
+                for (int i = 0; i < size; i++) {
+                    for (int j = 0; j < overlap; j++) {
+                        int dx = k == 0 ? j : k == 2 ? size - 1 - j : i;
+                        int dy = k == 1 ? j : k == 3 ? size - 1 - j : i;
+                        band[i * overlap + j] = errors[dy * size + dx];
+                    }
+                }
+                quilt__cut(band, size, overlap, cuts[k]);
+            }
+
+            // copy the patch, keeping old pixels on the outer side of any cut.
+            for (int dy = 0; dy < size; dy++) {
+                for (int dx = 0; dx < size; dx++) {
+                    Coord point = {x + dx, y + dy};
+                    if (!wrap_or_clip(parameters, s->data, &point)) continue;
+                    Status *status = image_atc(s->status, point);
+                    if (status->has_value && overlap > 0) {
+                        if ((use_cut[0] && dx < cuts[0][dy]) ||
+                            (use_cut[1] && dy < cuts[1][dx]) ||
+                            (use_cut[2] && size - 1 - dx < cuts[2][dy]) ||
+                            (use_cut[3] && size - 1 - dy < cuts[3][dx])) {
+                            continue;
+                        }
+                    }
+                    Coord from = {source.x + dx, source.y + dy};
+                    memcpy(image_atc(s->data, point),
+                           image_atc(s->corpus, from), s->input_bytes);
+                    status->has_value = true;
+                    status->has_source = true;
+                    status->source = from;
+                }
+            }
+
+            x += step;
+            if (!parameters.h_tile && x + overlap >= s->data.width) break;
+        }
+        y += step;
+        if (!parameters.v_tile && y + overlap >= s->data.height) break;
+    }
+
+    for (int k = 0; k < 4; k++) free(cuts[k]);
+    free(band);
+    free(errors);
+    free(candidate_errors);
+    free(candidates);
+}
+
+// a Wang tile set holds colors^4 square tiles, one for every combination
+// of edge colors, so that any two tiles with the same color on a shared edge
+// fit together seamlessly. assembling a texture from them is a copy per tile.
+//
+// to make edges match, every edge color gets a strip synthesized across
+// the edge, 2 * band pixels thick. a tile takes the inner half of the strips
+// of its four edge colors and synthesizes the rest in between.
+// a single corner patch is placed at both ends of every strip,
+// so the strips agree with each other wherever four tiles meet.
+struct _Resynth_wang {
+    int tile_size, colors, count;
+    int channels;
+    int width, height; // the output size of the state it was made from
+    bool h_tile, v_tile;
+    Pixel *tiles; // count * tile_size * tile_size * channels
+};
+
+typedef struct {
+    Resynth_state *s;
+    Parameters parameters;
+    int size, band, colors;
+    Resynth_state corner;
+    Resynth_state *strips; // the horizontal edge colors, then the vertical
+    Resynth_wang *wang;
+} Wang_job;
+
+static void wang__strip(void *arg, int index) {
+    Wang_job *job = arg;
+    const int size = job->size, band = job->band;
+    const bool vertical = index >= job->colors;
+
+    Resynth_state *t = &job->strips[index];
+    resynth__child(t, job->s, vertical ? 2 * band : size + 2 * band,
+                   vertical ? size + 2 * band : 2 * band,
+                   job->parameters, 1 + index);
+    resynth__copy(t, 0, 0, &job->corner, 0, 0, 2 * band, 2 * band);
+    resynth__copy(t, vertical ? 0 : size, vertical ? size : 0,
+                  &job->corner, 0, 0, 2 * band, 2 * band);
+    resynth__fill(t, job->parameters);
+}
+
+static void wang__tile(void *arg, int index) {
+    Wang_job *job = arg;
+    const int size = job->size, band = job->band, colors = job->colors;
+    const int west = index % colors;
+    const int south = index / colors % colors;
+    const int east = index / colors / colors % colors;
+    const int north = index / colors / colors / colors;
+    const Resynth_state *strips = job->strips;
+
+    Resynth_state tile;
+    Resynth_state *t = &tile;
+    resynth__child(t, job->s, size, size,
+                   job->parameters, 1 + 2 * colors + index);
+    resynth__copy(t, 0, 0, &strips[north], band, band, size, band);
+    resynth__copy(t, 0, size - band, &strips[south], band, 0, size, band);
+    resynth__copy(t, 0, 0, &strips[colors + west], band, band, band, size);
+    resynth__copy(t, size - band, 0, &strips[colors + east], 0, band, band, size);
+    resynth__fill(t, job->parameters);
+
+    const size_t tile_bytes = (size_t)size * size * t->input_bytes;
+    memcpy(job->wang->tiles + index * tile_bytes, t->data_array, tile_bytes);
+    state_free(t);
+}
+
+INLINE uint32_t wang__hash(uint32_t seed, int64_t x, int64_t y, uint32_t axis) {
+    // a murmur3-style mix of the seed, a grid point and the edge's direction.
+    uint32_t h = seed ^ axis * 0x9E3779B9u;
+    h ^= (uint32_t)x * 0x85EBCA6Bu ^ (uint32_t)((uint64_t)x >> 32) * 0x27D4EB2Fu;
+    h = (h << 13) | (h >> 19);
+    h ^= (uint32_t)y * 0xC2B2AE35u ^ (uint32_t)((uint64_t)y >> 32) * 0x165667B1u;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+INLINE int64_t floor_div(int64_t a, int64_t b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+static Resynth_wang *wang_create(Resynth_state *s, Parameters parameters,
+                                 int tile_size, int colors) {
+    const int band = CLAMP(parameters.tile_overlap, 1, tile_size / 2);
+    if (tile_size < 2 || tile_size > MIN(s->data.width, s->data.height)) {
+        fprintf(stderr, "invalid tile size: %i\n", tile_size);
+        return NULL;
+    }
+
+    Resynth_wang *wang = calloc(1, sizeof(Resynth_wang));
+    wang->tile_size = tile_size;
+    wang->colors = colors;
+    wang->count = colors * colors * colors * colors;
+    wang->channels = s->input_bytes;
+    wang->width = s->data.width;
+    wang->height = s->data.height;
+    wang->h_tile = parameters.h_tile;
+    wang->v_tile = parameters.v_tile;
+    wang->tiles = calloc((size_t)wang->count * tile_size * tile_size,
+                         s->input_bytes);
+
+    // every piece is synthesized on its own; nothing should wrap.
+    parameters.h_tile = false;
+    parameters.v_tile = false;
+    if (!resynth__tables(s, parameters)) {
+        resynth_free_wang(wang);
+        return NULL;
+    }
+
+    Wang_job job = {.s = s, .parameters = parameters, .size = tile_size,
+                    .band = band, .colors = colors};
+    job.wang = wang;
+    job.strips = calloc(2 * colors, sizeof(Resynth_state));
+    resynth__child(&job.corner, s, 2 * band, 2 * band, parameters, 0);
+    resynth__fill(&job.corner, parameters);
+    parallel_for(2 * colors, parameters, "wang strip", wang__strip, &job);
+    parallel_for(wang->count, parameters, "wang tile", wang__tile, &job);
+
+    for (int i = 0; i < 2 * colors; i++) state_free(&job.strips[i]);
+    free(job.strips);
+    state_free(&job.corner);
+    return wang;
+}
+
+static void wang_window(const Resynth_wang *wang, uint32_t seed,
+                        int64_t x, int64_t y, int width, int height,
+                        int64_t columns, int64_t rows, Pixel *out) {
+    // copy a window of the texture laid out over the grid of tiles.
+    // edge colors are hashed from their position, so every tile is picked
+    // independently of the others, and any window can be made on its own.
+    // with a nonzero number of columns (rows), the texture wraps around
+    // after that many tiles, by reusing the first edges for the last ones.
+    const int size = wang->tile_size, colors = wang->colors;
+    const size_t tile_bytes = (size_t)size * size * wang->channels;
+
+    const int64_t j0 = floor_div(y, size), j1 = floor_div(y + height - 1, size);
+    const int64_t i0 = floor_div(x, size), i1 = floor_div(x + width - 1, size);
+    for (int64_t j = j0; j <= j1; j++) {
+        const int64_t next_j = rows && j + 1 == rows ? 0 : j + 1;
+        for (int64_t i = i0; i <= i1; i++) {
+            const int64_t next_i = columns && i + 1 == columns ? 0 : i + 1;
+            const int north = wang__hash(seed, i, j, 0) % colors;
+            const int south = wang__hash(seed, i, next_j, 0) % colors;
+            const int west = wang__hash(seed, i, j, 1) % colors;
+            const int east = wang__hash(seed, next_i, j, 1) % colors;
+            const int index = ((north * colors + east) * colors + south) * colors + west;
+            const Pixel *tile = wang->tiles + index * tile_bytes;
+
+            // the part of this tile that falls into the window.
+            const int64_t tx = i * size, ty = j * size;
+            const int from_x = (int)(MAX(x, tx) - tx), to_x = (int)(MAX(x, tx) - x);
+            const int from_y = (int)(MAX(y, ty) - ty), to_y = (int)(MAX(y, ty) - y);
+            const int w = MIN(size - from_x, width - to_x);
+            const int h = MIN(size - from_y, height - to_y);
+            for (int k = 0; k < h; k++) {
+                memcpy(out + ((size_t)(to_y + k) * width + to_x) * wang->channels,
+                       tile + ((size_t)(from_y + k) * size + from_x) * wang->channels,
+                       (size_t)w * wang->channels);
+            }
+        }
+    }
+}
+
+static const int disc00[] = {
+    // http://oeis.org/A057961
+    1,    5,    9,    13,   21,   25,   29,   37,
+    45,   49,   57,   61,   69,   81,   89,   97,
+    101,  109,  113,  121,  129,  137,  145,  149,
+    161,  169,  177,  185,  193,  197,  213,  221,
+    225,  233,  241,  249,  253,  261,  277,  285,
+    293,  301,  305,  317,  325,  333,  341,  349,
+    357,  365,  373,  377,  385,  401,  405,  421,
+    429,  437,  441,  457,  465,  473,  481,  489,
+    497,  505,  509,  517,  529,  545,  553,  561,
+    569,  577,  593,  601,  609,  613,  621,  633,
+    641,  657,  665,  673,  681,  697,  709,  717,
+    725,  733,  741,  749,  757,  761,  769,  777,
+    793,  797,  805,  821,  829,  845,  853,  861,
+    869,  877,  885,  889,  901,  917,  925,  933,
+    941,  949,  965,  973,  981,  989,  997,  1005,
+    1009, 1033, 1041, 1049, 1057, 1069, 1085, 1093
+};
+
+// API Functions
+/* Image and Buffer Loading */
+resynth_state_t
+resynth_state_create_from_image(const char* filename, int desired_channels, int scale) {
+    resynth_state_t s = calloc(1, sizeof(Resynth_state));
+    int w, h, d;
+    phase("decode", true);
+    uint8_t *image = stbi_load(filename, &w, &h, &d, desired_channels);
+    phase("decode", false);
+    if (image == NULL) {
         fprintf(stderr, "invalid image: %s\n", filename);
         return NULL;
     }
@@ -465,6 +2427,21 @@ resynth_state_create_from_image(const char* filename, int desired_channels, int
     return s;
 }
 
+resynth_state_t
+resynth_state_create_from_encoded(const uint8_t* data, size_t size, int desired_channels, int scale) {
+    assert(data != NULL);
+    if (size > INT_MAX) return NULL;
+    int w, h, d;
+    phase("decode", true);
+    uint8_t *image = stbi_load_from_memory(data, (int)size, &w, &h, &d, desired_channels);
+    phase("decode", false);
+    if (image == NULL) return NULL;
+
+    resynth_state_t s = resynth_state_create_from_memory(image, w, h, desired_channels, scale);
+    stbi_image_free(image);
+    return s;
+}
+
 resynth_state_t
 resynth_state_create_from_memory(uint8_t* pixels, size_t width, size_t height, size_t channels, int scale) {
     assert(pixels != NULL);
@@ -488,6 +2465,91 @@ resynth_state_create_from_memory(uint8_t* pixels, size_t width, size_t height, s
     return s;
 }
 
+resynth_state_t
+resynth_state_create_from_exemplars(uint8_t* const* pixels, const size_t* widths, const size_t* heights, size_t count, size_t channels, int scale) {
+    assert(pixels != NULL);
+    assert(count > 0);
+    assert(channels >= 3);
+    if (count == 1) {
+        return resynth_state_create_from_memory(pixels[0], widths[0], heights[0],
+                                                channels, scale);
+    }
+
+    int width = 0, height = 0;
+    for (size_t i = 0; i < count; i++) {
+        assert(widths[i] > 0 && heights[i] > 0);
+        width += widths[i];
+        height = MAX(height, (int)heights[i]);
+    }
+
+    resynth_state_t s = calloc(1, sizeof(Resynth_state));
+    IMAGE_RESIZE(s->corpus, width, height, channels);
+    MEMORY(s->exemplars, count);
+    MEMORY(s->exemplar_columns, width);
+    s->exemplar_count = count;
+
+    int x = 0;
+    for (size_t i = 0; i < count; i++) {
+        Exemplar *e = &s->exemplars[i];
+        *e = (Exemplar){x, widths[i], heights[i], s->exemplar_area};
+        for (int y = 0; y < e->height; y++) {
+            memcpy(image_at(s->corpus, x, y),
+                   pixels[i] + (size_t)y * e->width * channels,
+                   (size_t)e->width * channels);
+        }
+        for (int k = 0; k < e->width; k++) s->exemplar_columns[x + k] = i;
+        x += e->width;
+        s->exemplar_area += e->width * e->height;
+    }
+
+    // the output is sized after the first exemplar.
+    s->input_bytes = MAX(channels, 3);
+    {
+        int data_w = 256, data_h = 256;
+        if (scale > 0) data_w = scale * widths[0], data_h = scale * heights[0];
+        if (scale < 0) data_w = -scale, data_h = -scale;
+        IMAGE_RESIZE(s->data, data_w, data_h, s->input_bytes);
+    }
+
+    return s;
+}
+
+resynth_state_t
+resynth_state_create_from_images(const char* const* filenames, size_t count, int desired_channels, int scale) {
+    assert(filenames != NULL);
+    assert(count > 0);
+    uint8_t **images = calloc(count, sizeof(uint8_t *));
+    size_t *widths = calloc(count, sizeof(size_t));
+    size_t *heights = calloc(count, sizeof(size_t));
+    bool ok = true;
+    phase("decode", true);
+    for (size_t i = 0; i < count; i++) {
+        int w, h, d;
+        images[i] = stbi_load(filenames[i], &w, &h, &d, desired_channels);
+        if (images[i] == NULL) {
+            fprintf(stderr, "invalid image: %s\n", filenames[i]);
+            ok = false;
+            break;
+        }
+        widths[i] = w;
+        heights[i] = h;
+    }
+    phase("decode", false);
+
+    resynth_state_t s = NULL;
+    if (ok) {
+        s = resynth_state_create_from_exemplars(images, widths, heights, count,
+                                                desired_channels, scale);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (images[i] != NULL) stbi_image_free(images[i]);
+    }
+    free(images);
+    free(widths);
+    free(heights);
+    return s;
+}
+
 resynth_state_t
 resynth_state_create_from_memoryf(float* pixels, size_t width, size_t height, size_t channels, int scale) {
     size_t size = width * height * channels;
@@ -498,6 +2560,106 @@ resynth_state_create_from_memoryf(float* pixels, size_t width, size_t height, si
     return resynth_state_create_from_memory(pixels_u8, width, height, channels, scale);
 }
 
+size_t
+resynth_state_width(resynth_state_t state) {
+    return state->data.width;
+}
+
+size_t
+resynth_state_height(resynth_state_t state) {
+    return state->data.height;
+}
+
+size_t
+resynth_state_channels(resynth_state_t state) {
+    return state->data.depth;
+}
+
+void
+resynth_state_result_ownership(resynth_state_t state, resynth_ownership_t ownership) {
+    assert(state != NULL);
+    state->ownership = ownership;
+}
+
+void
+resynth_state_warm_start(resynth_state_t state, const uint8_t* pixels, const int32_t* sources) {
+    assert(state != NULL);
+    Resynth_state *s = state;
+    state__reclaim(s);
+    IMAGE_RESIZE(s->status, s->data.width, s->data.height, 1);
+    s->warm = pixels != NULL || sources != NULL;
+
+    for (int y = 0; y < s->data.height; y++) {
+        for (int x = 0; x < s->data.width; x++) {
+            const size_t i = (size_t)y * s->data.width + x;
+            Status *status = image_at(s->status, x, y);
+            if (sources != NULL) {
+                Coord source = {sources[2 * i], sources[2 * i + 1]};
+                if (corpus_has(s, source)) {
+                    status->has_value = true;
+                    status->has_source = true;
+                    status->source = source;
+                    memcpy(image_at(s->data, x, y),
+                           image_atc(s->corpus, source), s->input_bytes);
+                }
+            }
+            if (pixels != NULL) {
+                status->has_value = true;
+                memcpy(image_at(s->data, x, y),
+                       pixels + i * s->data.depth, s->data.depth);
+            }
+        }
+    }
+}
+
+/* Tracing */
+void
+resynth_set_phase_hook(resynth_phase_hook_t hook, void* user) {
+    pthread_mutex_lock(&tracing.lock);
+    tracing.hook = hook;
+    tracing.user = user;
+    tracing__update();
+    pthread_mutex_unlock(&tracing.lock);
+}
+
+void
+resynth_phase(const char* name, bool begin) {
+    phase(name, begin);
+}
+
+bool
+resynth_trace_start(const char* path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "failed to open trace: %s\n", path);
+        return false;
+    }
+    resynth_trace_stop();
+    pthread_once(&fork_once, fork__register);
+    pthread_mutex_lock(&tracing.lock);
+    tracing.file = f;
+    tracing.first_event = true;
+    tracing.origin = monotonic_seconds();
+    tracing.generation++;
+    tracing.threads = 0;
+    fputs("[\n", f);
+    tracing__update();
+    pthread_mutex_unlock(&tracing.lock);
+    return true;
+}
+
+void
+resynth_trace_stop(void) {
+    pthread_mutex_lock(&tracing.lock);
+    if (tracing.file) {
+        fputs("\n]\n", tracing.file);
+        fclose(tracing.file);
+        tracing.file = NULL;
+    }
+    tracing__update();
+    pthread_mutex_unlock(&tracing.lock);
+}
+
 /* Config */
 resynth_parameters_t
 resynth_parameters_create() {
@@ -509,6 +2671,19 @@ resynth_parameters_create() {
     parameters->neighbors = 29;      // 30
     parameters->tries = 192;         // 200 (or 80 in the paper)
     parameters->random_seed = time(0);
+    parameters->tile_size = 0;       // disabled
+    parameters->tile_overlap = 8;
+    parameters->threads = 0;         // one per core
+    parameters->engine = RESYNTH_ENGINE_PIXEL;
+    parameters->patch_size = 32;
+    parameters->patch_overlap = 8;
+    parameters->polish = RESYNTH_POLISH_MAGIC;
+    parameters->polish_target = 0;
+    parameters->polish_passes = 8;
+    parameters->sparse_core = 0;     // disabled
+    parameters->sparse_dilation = 3;
+    parameters->dense_passes = 1;
+    parameters->executor = builtin_executor;
     return parameters;
 }
 
@@ -547,25 +2722,360 @@ resynth_parameters_random_seed(resynth_parameters_t parameters, unsigned long se
     parameters->random_seed = seed;
 }
 
+void
+resynth_parameters_tiles(resynth_parameters_t parameters, int tile_size, int overlap) {
+    parameters->tile_size = CLAMPV(tile_size, 0, 65536);
+    parameters->tile_overlap = CLAMPV(overlap, 0, 1024);
+}
+
+void
+resynth_parameters_threads(resynth_parameters_t parameters, int threads) {
+    parameters->threads = CLAMPV(threads, 0, 1024);
+}
+
+void
+resynth_parameters_executor(resynth_parameters_t parameters, const resynth_executor_t* executor) {
+    parameters->executor = executor ? *executor : builtin_executor;
+}
+
+void
+resynth_parameters_checkpoint(resynth_parameters_t parameters, const char* path, double seconds) {
+    free(parameters->checkpoint_path);
+    parameters->checkpoint_path = path ? strdup(path) : NULL;
+    parameters->checkpoint_interval = MAX(seconds, 0.);
+}
+
+void
+resynth_parameters_engine(resynth_parameters_t parameters, resynth_engine_t engine) {
+    parameters->engine = engine;
+}
+
+void
+resynth_parameters_patch(resynth_parameters_t parameters, int patch_size, int overlap) {
+    parameters->patch_size = CLAMPV(patch_size, 2, 1024);
+    parameters->patch_overlap = CLAMPV(overlap, 0, patch_size / 2);
+}
+
+void
+resynth_parameters_generic_kernel(resynth_parameters_t parameters, bool generic) {
+    parameters->generic_kernel = generic;
+}
+
+void
+resynth_parameters_adaptive_tries(resynth_parameters_t parameters, bool adaptive) {
+    parameters->adaptive_tries = adaptive;
+}
+
+void
+resynth_parameters_sparse(resynth_parameters_t parameters, int core, int dilation, int dense_passes) {
+    parameters->sparse_core = CLAMPV(core, 0, disc00[LEN(disc00) - 1]);
+    parameters->sparse_dilation = CLAMPV(dilation, 1, 64);
+    parameters->dense_passes = CLAMPV(dense_passes, 0, 1024);
+}
+
+void
+resynth_parameters_polish(resynth_parameters_t parameters, resynth_polish_t polish, double target, int passes) {
+    parameters->polish = polish;
+    parameters->polish_target = CLAMPV(target, 0., 1.);
+    parameters->polish_passes = CLAMPV(passes, 0, 1024);
+}
+
 /* Processing and Results */ 
+static bool run__tiled(const Resynth_state *s, Parameters parameters) {
+    const int tile_size = parameters.tile_size;
+    return tile_size > 0 &&
+        (s->data.width > tile_size || s->data.height > tile_size);
+}
+
+// whether a warm start is used by a run with these parameters.
+static bool run__warm(const Resynth_state *s, Parameters parameters) {
+    return s->warm && parameters.engine != RESYNTH_ENGINE_QUILT &&
+        !run__tiled(s, parameters);
+}
+
+static resynth_result_t run(Resynth_state *s, Parameters parameters) {
+    state__reclaim(s);
+    rnd_pcg_seed(&s->rng, parameters.random_seed);
+
+    // a warm start only lasts for one run, used or not.
+    s->warm = run__warm(s, parameters);
+
+    resynth_result_t result = calloc(1, sizeof(Resynth_result));
+    if (parameters.engine == RESYNTH_ENGINE_QUILT) {
+        phase("quilt", true);
+        quilt(s, parameters);
+        phase("quilt", false);
+    } else if (run__tiled(s, parameters)) {
+        resynth_tiled(s, parameters);
+    } else {
+        resynth(s, parameters);
+    }
+
+    result_from_state(result, s);
+    result__detach(result, s);
+    return result;
+}
+
 resynth_result_t 
 resynth_run(resynth_state_t state, resynth_parameters_t parameters) {
     assert(state != NULL);
     assert(parameters != NULL);
+    return run(state, *parameters);
+}
+
+size_t
+resynth_tile_count(resynth_state_t state, resynth_parameters_t parameters) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+    if (parameters->engine == RESYNTH_ENGINE_QUILT) return 0;
+    return tile__count(state, *parameters);
+}
+
+bool
+resynth_tile_run(resynth_state_t state, resynth_parameters_t parameters, size_t index, uint8_t* pixels, int32_t* sources) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+    assert(pixels != NULL);
+    Resynth_state *s = state;
+    if (index >= resynth_tile_count(s, parameters)) return false;
+
+    // the offsets only depend on the corpus, so they're kept for the next tile.
+    if (s->sorted_offsets == NULL) {
+        if (!resynth__tables(s, *parameters)) return false;
+    } else {
+        make_diff_table(s, *parameters);
+    }
+
+    Resynth_state tile;
+    Resynth_state *t = &tile;
+    phase("tile", true);
+    const Coord at = tile__fill(t, s, *parameters, (int)index);
+    phase("tile", false);
+    for (int y = 0; y < t->data.height; y++) {
+        for (int x = 0; x < t->data.width; x++) {
+            const size_t i = (size_t)(at.y + y) * s->data.width + (at.x + x);
+            const Status *status = image_at(t->status, x, y);
+            memcpy(pixels + i * s->data.depth, image_at(t->data, x, y),
+                   s->data.depth);
+            if (sources == NULL) continue;
+            sources[2 * i] = status->has_source ? status->source.x : -1;
+            sources[2 * i + 1] = status->has_source ? status->source.y : -1;
+        }
+    }
+    state_free(t);
+    return true;
+}
+
+resynth_result_t
+resynth_tile_seams(resynth_state_t state, resynth_parameters_t parameters, const uint8_t* pixels, const int32_t* sources) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+    assert(pixels != NULL);
+    Resynth_state *s = state;
+    Parameters p = *parameters;
+    state__reclaim(s);
+    rnd_pcg_seed(&s->rng, p.random_seed);
+    s->warm = false; // tiled runs aren't warm started
+
+    // the same as the end of resynth_tiled, once the tiles are in place.
+    resynth_result_t result = calloc(1, sizeof(Resynth_result));
+    if (resynth__tables(s, p)) {
+        resynth__work(s, p);
+        for (int y = 0; y < s->data.height; y++) {
+            for (int x = 0; x < s->data.width; x++) {
+                const size_t i = (size_t)y * s->data.width + x;
+                Status *status = image_at(s->status, x, y);
+                memcpy(image_at(s->data, x, y), pixels + i * s->data.depth,
+                       s->data.depth);
+                status->has_value = true;
+                if (sources != NULL && sources[2 * i] >= 0) {
+                    status->has_source = true;
+                    status->source = (Coord){sources[2 * i], sources[2 * i + 1]};
+                }
+            }
+        }
+        resynth__seams(s, p);
+    }
+
+    result_from_state(result, s);
+    result__detach(result, s);
+    return result;
+}
+
+struct _Resynth_task {
+    Resynth_state *state;
+    Parameters parameters; // a copy, so the caller's can change meanwhile
+    resynth_result_t result;
+    void *group;
+    atomic_bool done;
+};
+
+static void task__run(void *arg) {
+    Resynth_task *task = arg;
+    task->result = run(task->state, task->parameters);
+    atomic_store(&task->done, true);
+}
+
+resynth_task_t
+resynth_run_async(resynth_state_t state, resynth_parameters_t parameters) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+
+    resynth_task_t task = calloc(1, sizeof(Resynth_task));
+    task->state = state;
+    task->parameters = *parameters;
+    if (parameters->checkpoint_path) {
+        task->parameters.checkpoint_path = strdup(parameters->checkpoint_path);
+    }
+    atomic_init(&task->done, false);
+
+    // the run itself takes up a thread of its own, besides its helpers.
+    const resynth_executor_t *executor = &task->parameters.executor;
+    parallel_prepare(task->parameters, parallel_threads(task->parameters));
+    task->group = executor->group_create(executor->user);
+    executor->submit(executor->user, task->group, task__run, task);
+    return task;
+}
+
+bool
+resynth_task_done(resynth_task_t task) {
+    return atomic_load(&task->done);
+}
+
+resynth_result_t
+resynth_task_wait(resynth_task_t task) {
+    const resynth_executor_t *executor = &task->parameters.executor;
+    executor->wait(executor->user, task->group);
+    resynth_result_t result = task->result;
+    free(task->parameters.checkpoint_path);
+    free(task);
+    return result;
+}
+
+resynth_result_t
+resynth_run_anytime(resynth_state_t state, resynth_parameters_t parameters, double seconds, resynth_progress_t progress, void* user) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+    const double deadline = monotonic_seconds() + seconds;
 
-    rnd_pcg_seed(&pcg, parameters->random_seed);
+    state__reclaim(state);
+    rnd_pcg_seed(&state->rng, parameters->random_seed);
 
     resynth_result_t result = calloc(1, sizeof(Resynth_result));
-    resynth(state, *parameters);
+    resynth_anytime(state, *parameters, deadline, result, progress, user);
+    result__detach(result, state);
+    return result;
+}
 
-    result->pixels = state->data_array;
-    result->width = state->data.width;
-    result->height = state->data.height;
-    result->channels = state->data.depth;
-    result->valid = true;
+bool
+resynth_autotune(resynth_state_t state, resynth_parameters_t parameters, double target_energy, resynth_tuning_t* choice) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+
+    resynth_tuning_t tuning = {0};
+    bool reached = autotune(state, *parameters, target_energy, &tuning);
+    if (tuning.neighbors > 0) {
+        parameters->neighbors = tuning.neighbors;
+        parameters->tries = tuning.tries;
+        parameters->magic = tuning.magic;
+    }
+    if (choice != NULL) *choice = tuning;
+    return reached;
+}
+
+resynth_result_t
+resynth_resume(resynth_state_t state, resynth_parameters_t parameters, const char* path) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+    assert(path != NULL);
+
+    state__reclaim(state);
+    resynth_result_t result = calloc(1, sizeof(Resynth_result));
+    if (checkpoint_load(state, *parameters, path)) {
+        result_from_state(result, state);
+        result__detach(result, state);
+    }
     return result;
 }
 
+const char*
+resynth_kernel_name(resynth_state_t state, resynth_parameters_t parameters) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+    const int kernel = pick_kernel(state, *parameters);
+    return kernel < 0 ? "generic" : try_kernels[kernel].name;
+}
+
+int
+resynth_version(void) {
+    return RESYNTH_VERSION;
+}
+
+uint64_t
+resynth_hash(resynth_state_t state, resynth_parameters_t parameters) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+    const Resynth_state *s = state;
+    const Parameters *p = parameters;
+    uint64_t hash = HASH_INIT;
+    const int version = RESYNTH_VERSION;
+    HASH_VALUE(hash, version);
+
+    HASH_VALUE(hash, s->corpus.width);
+    HASH_VALUE(hash, s->corpus.height);
+    HASH_VALUE(hash, s->corpus.depth);
+    hash = hash_bytes(hash, s->corpus_array,
+        (size_t)s->corpus.width * s->corpus.height * s->corpus.depth);
+    if (s->exemplar_count > 1) {
+        hash = hash_bytes(hash, s->exemplars,
+                          (size_t)s->exemplar_count * sizeof(Exemplar));
+    }
+    HASH_VALUE(hash, s->data.width);
+    HASH_VALUE(hash, s->data.height);
+    HASH_VALUE(hash, s->data.depth);
+    HASH_VALUE(hash, s->input_bytes);
+
+    // a warm start counts with whatever it seeded, if the run uses it.
+    const bool warm = run__warm(s, *p);
+    HASH_VALUE(hash, warm);
+    if (warm) {
+        for (int y = 0; y < s->data.height; y++) {
+            for (int x = 0; x < s->data.width; x++) {
+                const Status *status = image_at(s->status, x, y);
+                HASH_VALUE(hash, status->has_value);
+                HASH_VALUE(hash, status->has_source);
+                if (status->has_source) HASH_VALUE(hash, status->source);
+                if (status->has_value) {
+                    hash = hash_bytes(hash, image_at(s->data, x, y), s->data.depth);
+                }
+            }
+        }
+    }
+
+    // field by field, leaving out padding and whatever doesn't change
+    // the output: threads, the executor, checkpoints and the kernel choice.
+    HASH_VALUE(hash, p->h_tile);
+    HASH_VALUE(hash, p->v_tile);
+    HASH_VALUE(hash, p->autism);
+    HASH_VALUE(hash, p->neighbors);
+    HASH_VALUE(hash, p->tries);
+    HASH_VALUE(hash, p->magic);
+    HASH_VALUE(hash, p->random_seed);
+    HASH_VALUE(hash, p->tile_size);
+    HASH_VALUE(hash, p->tile_overlap);
+    HASH_VALUE(hash, p->engine);
+    HASH_VALUE(hash, p->patch_size);
+    HASH_VALUE(hash, p->patch_overlap);
+    HASH_VALUE(hash, p->polish);
+    HASH_VALUE(hash, p->polish_target);
+    HASH_VALUE(hash, p->polish_passes);
+    HASH_VALUE(hash, p->adaptive_tries);
+    HASH_VALUE(hash, p->sparse_core);
+    HASH_VALUE(hash, p->sparse_dilation);
+    HASH_VALUE(hash, p->dense_passes);
+    return hash;
+}
+
 bool 
 resynth_result_valid(resynth_result_t result) {
     return result->valid;
@@ -591,6 +3101,46 @@ resynth_result_pixelsf(resynth_result_t result) {
     return result->pixelsf;
 }
 
+double
+resynth_result_energy(resynth_result_t result) {
+    return result->energy;
+}
+
+double
+resynth_result_measure(resynth_result_t result, resynth_state_t state, resynth_parameters_t parameters, float* error_map) {
+    assert(result != NULL);
+    assert(state != NULL);
+    assert(parameters != NULL);
+
+    // only results still backed by the state that made them can be measured.
+    if (!result->valid || result->status == NULL ||
+        result->status != state->status_array) return -1;
+
+    // quilting doesn't need the offsets, and the diff table may be stale.
+    if (state->sorted_offsets == NULL) make_offset_list(state);
+    make_diff_table(state, *parameters);
+
+    result->energy = resynth__energy(state, *parameters, error_map);
+    return result->energy;
+}
+
+int32_t*
+resynth_result_sources(resynth_result_t result) {
+    if (result->sources != NULL || result->status == NULL)
+        return result->sources;
+    size_t area = result->width * result->height;
+    int32_t* sources = calloc(area * 2, sizeof(int32_t));
+
+    for (size_t i = 0; i < area; ++i) {
+        const Status *status = &result->status[i];
+        sources[2 * i] = status->has_source ? status->source.x : -1;
+        sources[2 * i + 1] = status->has_source ? status->source.y : -1;
+    }
+    result->sources = sources;
+
+    return result->sources;
+}
+
 size_t
 resynth_result_width(resynth_result_t result) {
     return result->width;
@@ -607,6 +3157,143 @@ resynth_result_channels(resynth_result_t result) {
 }
 
 
+/* Wang Tiles */
+resynth_wang_t
+resynth_wang_create(resynth_state_t state, resynth_parameters_t parameters, int tile_size, int colors) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+    return wang_create(state, *parameters, tile_size, CLAMP(colors, 1, 4));
+}
+
+resynth_result_t
+resynth_wang_assemble(resynth_wang_t wang, size_t width, size_t height, unsigned long seed) {
+    assert(wang != NULL);
+    if (!width) width = wang->width;
+    if (!height) height = wang->height;
+
+    resynth_result_t result = calloc(1, sizeof(Resynth_result));
+    result->pixels = calloc(width * height, wang->channels);
+    result->owns_pixels = true;
+    const int size = wang->tile_size;
+    wang_window(wang, (uint32_t)seed, 0, 0, width, height,
+                wang->h_tile ? (width + size - 1) / size : 0,
+                wang->v_tile ? (height + size - 1) / size : 0,
+                result->pixels);
+
+    result->width = width;
+    result->height = height;
+    result->channels = wang->channels;
+    result->valid = true;
+    return result;
+}
+
+void
+resynth_wang_window(resynth_wang_t wang, unsigned long seed, int64_t x, int64_t y, size_t width, size_t height, uint8_t* pixels) {
+    assert(wang != NULL);
+    assert(pixels != NULL);
+    if (!width || !height) return;
+    wang_window(wang, (uint32_t)seed, x, y, width, height, 0, 0, pixels);
+}
+
+size_t
+resynth_wang_channels(resynth_wang_t wang) {
+    return wang->channels;
+}
+
+size_t
+resynth_wang_tile_count(resynth_wang_t wang) {
+    return wang->count;
+}
+
+uint8_t*
+resynth_wang_tile_pixels(resynth_wang_t wang, size_t index) {
+    assert(index < (size_t)wang->count);
+    return wang->tiles + index * wang->tile_size * wang->tile_size * wang->channels;
+}
+
+
+/* Sequences */
+// a sequence keeps the previous frame's sources, and moves them along
+// the displacement field into a warm start for the next frame.
+struct _Resynth_sequence {
+    Resynth_state *state;
+    Parameters parameters; // a copy, without checkpoints
+    int32_t *sources, *advected; // NULL until there's a previous frame
+    int frame;
+};
+
+resynth_sequence_t
+resynth_sequence_create(resynth_state_t state, resynth_parameters_t parameters) {
+    assert(state != NULL);
+    assert(parameters != NULL);
+    resynth_sequence_t sequence = calloc(1, sizeof(Resynth_sequence));
+    sequence->state = state;
+    sequence->parameters = *parameters;
+    sequence->parameters.checkpoint_path = NULL;
+    return sequence;
+}
+
+static void sequence__advect(resynth_sequence_t sequence,
+                             const float *displacement) {
+    const Resynth_state *s = sequence->state;
+    const Parameters parameters = sequence->parameters;
+    const int width = s->data.width, height = s->data.height;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const size_t i = (size_t)y * width + x;
+            Coord from = {x, y};
+            if (displacement != NULL) {
+                from.x = (int)lrintf(x - displacement[2 * i]);
+                from.y = (int)lrintf(y - displacement[2 * i + 1]);
+            }
+            const Image bounds = {width, height, 1};
+            int32_t *to = sequence->advected + 2 * i;
+            if (!wrap_or_clip(parameters, bounds, &from)) {
+                to[0] = to[1] = -1;
+                continue;
+            }
+            const size_t j = (size_t)from.y * width + from.x;
+            to[0] = sequence->sources[2 * j];
+            to[1] = sequence->sources[2 * j + 1];
+        }
+    }
+}
+
+resynth_result_t
+resynth_sequence_next(resynth_sequence_t sequence, const float* displacement) {
+    assert(sequence != NULL);
+    Resynth_state *s = sequence->state;
+    Parameters parameters = sequence->parameters;
+    parameters.random_seed += sequence->frame;
+
+    const size_t area = (size_t)s->data.width * s->data.height;
+    if (sequence->sources != NULL) {
+        sequence__advect(sequence, displacement);
+        resynth_state_warm_start(s, NULL, sequence->advected);
+        // warm starts only apply to untiled per-pixel runs. most pixels
+        // already fit their neighbors, so most random tries can be skipped.
+        parameters.tile_size = 0;
+        parameters.engine = RESYNTH_ENGINE_PIXEL;
+        parameters.adaptive_tries = true;
+    }
+    resynth_result_t result = run(s, parameters);
+    sequence->frame++;
+
+    // (without sources, e.g. after a failed run, the next frame starts over)
+    const int32_t *sources = resynth_result_sources(result);
+    if (sources == NULL) {
+        MEMORY(sequence->sources, 0);
+        MEMORY(sequence->advected, 0);
+        return result;
+    }
+    if (sequence->sources == NULL) {
+        MEMORY(sequence->sources, 2 * area);
+        MEMORY(sequence->advected, 2 * area);
+    }
+    memcpy(sequence->sources, sources, 2 * area * sizeof(int32_t));
+    return result;
+}
+
 /* Memory Management */ 
 void
 resynth_free_state(resynth_state_t state) {
@@ -616,13 +3303,34 @@ resynth_free_state(resynth_state_t state) {
 
 void
 resynth_free_parameters(resynth_parameters_t parameters) {
+    free(parameters->checkpoint_path);
     free(parameters);
 }
 
+void
+resynth_free_sequence(resynth_sequence_t sequence) {
+    free(sequence->sources);
+    free(sequence->advected);
+    free(sequence);
+}
+
+void
+resynth_free_wang(resynth_wang_t wang) {
+    free(wang->tiles);
+    free(wang);
+}
+
 void
 resynth_free_result(resynth_result_t result) {
     if (result->pixelsf != NULL)
         free(result->pixelsf);
+    free(result->sources);
+    if (result->owns_pixels)
+        free(result->pixels);
+    if (result->buffers) {
+        free((Status *)result->status);
+        buffers_give(result->buffers, result->pixels);
+    }
     free(result);
 }
 
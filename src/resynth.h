@@ -25,24 +25,121 @@ extern "C" {
 struct _Resynth_state;
 struct _Parameters;
 struct _Resynth_result;
+struct _Resynth_wang;
+struct _Resynth_task;
+struct _Resynth_sequence;
 typedef struct _Resynth_state Resynth_state;
 typedef struct _Parameters Parameters;
 typedef struct _Resynth_result Resynth_result;
+typedef struct _Resynth_wang Resynth_wang;
+typedef struct _Resynth_task Resynth_task;
+typedef struct _Resynth_sequence Resynth_sequence;
 
 typedef Resynth_result* resynth_result_t;
 typedef Resynth_state* resynth_state_t;
 typedef Parameters* resynth_parameters_t;
+typedef Resynth_wang* resynth_wang_t;
+typedef Resynth_task* resynth_task_t;
+typedef Resynth_sequence* resynth_sequence_t;
+
+typedef void (*resynth_progress_t)(void* user, resynth_result_t result);
+
+typedef void (*resynth_phase_hook_t)(void* user, const char* name, bool begin);
+
+typedef struct {
+    int neighbors, tries, magic;
+    double energy;            // as in resynth_result_energy
+    double seconds_per_pixel; // of CPU time
+} resynth_tuning_t;
+
+typedef enum {
+    RESYNTH_ENGINE_PIXEL, // pixel-by-pixel resynthesis (the default)
+    RESYNTH_ENGINE_QUILT, // patch-based image quilting
+} resynth_engine_t;
+
+typedef enum {
+    RESYNTH_POLISH_MAGIC, // only what magic does (the default)
+    RESYNTH_POLISH_WORST, // then revisit the worst-fitting pixels and their neighbors
+} resynth_polish_t;
+
+typedef enum {
+    RESYNTH_RESULT_SHARED,   // results use the state's buffers until its next run (the default)
+    RESYNTH_RESULT_DETACHED, // results keep them, and the state takes others from a pool
+} resynth_ownership_t;
+
+/* runs tasks for resynth, e.g. on the host application's thread pool.
+   a group collects the tasks submitted to it, which may run in any order,
+   on any thread. wait returns once all of a group's tasks are done,
+   and frees the group. tasks may create and wait on groups of their own,
+   so wait shouldn't leave a thread idle while that group's tasks are
+   still queued; running them on the waiting thread is the simplest fix.
+   threads is how many tasks can usefully run at once, or 0 for one per core. */
+typedef struct {
+    void* user;
+    int threads;
+    void* (*group_create)(void* user);
+    void (*submit)(void* user, void* group, void (*task)(void* arg), void* arg);
+    void (*wait)(void* user, void* group);
+} resynth_executor_t;
 
 /* Image and Buffer Loading */
 resynth_state_t
 resynth_state_create_from_image(const char* filename, int desired_channels, int scale);
 
+/* a corpus of several exemplars, e.g. photos of the same surface, each
+   widths[i] * heights[i] * channels. they're combined into one atlas, so
+   candidates and random tries come from all of them and the tables are
+   only made once, but no neighborhood reaches across exemplars; their edges
+   are penalized like the corpus's own. the output's size is based on
+   the first exemplar's. */
+resynth_state_t
+resynth_state_create_from_exemplars(uint8_t* const* pixels, const size_t* widths, const size_t* heights, size_t count, size_t channels, int scale);
+
+/* likewise, from image files. returns NULL if any can't be decoded. */
+resynth_state_t
+resynth_state_create_from_images(const char* const* filenames, size_t count, int desired_channels, int scale);
+
+/* like resynth_state_create_from_image, from a png, jpeg, bmp or gif
+   already in memory. returns NULL if it can't be decoded. */
+resynth_state_t
+resynth_state_create_from_encoded(const uint8_t* data, size_t size, int desired_channels, int scale);
+
 resynth_state_t
 resynth_state_create_from_memory(uint8_t* pixels, size_t width, size_t height, size_t channels, int scale);
 
 resynth_state_t
 resynth_state_create_from_memoryf(float* pixels, size_t width, size_t height, size_t channels, int scale);
 
+/* the size of the state's outputs. */
+size_t
+resynth_state_width(resynth_state_t state);
+
+size_t
+resynth_state_height(resynth_state_t state);
+
+size_t
+resynth_state_channels(resynth_state_t state);
+
+/* who owns the pixels of results from this state. shared results are only
+   valid until the state runs again, while detached ones stay valid until
+   they're freed (on any thread), so the state can be run again right away.
+   the state then takes buffers that freed results have given back,
+   so alternating between two is as cheap as sharing one. either way,
+   results can only be measured until the state runs again. */
+void
+resynth_state_result_ownership(resynth_state_t state, resynth_ownership_t ownership);
+
+/* seeds the next run with a previous output (width * height * channels)
+   and/or source map (width * height pairs of x, y corpus coordinates, as
+   returned by resynth_result_sources; negative for none), both at the
+   state's output size. seeded pixels are refined in a single polishing-style
+   pass instead of being synthesized from scratch, and pixels with a source
+   give coherent candidates right away. either may be NULL.
+   only the next run is warm started, and only if it's untiled and per
+   pixel; a tiled or quilted run drops the warm start. */
+void
+resynth_state_warm_start(resynth_state_t state, const uint8_t* pixels, const int32_t* sources);
+
 /* Config */
 resynth_parameters_t
 resynth_parameters_create();
@@ -68,11 +165,151 @@ resynth_parameters_magic(resynth_parameters_t parameters, int magic);
 void
 resynth_parameters_random_seed(resynth_parameters_t parameters, unsigned long seed);
 
+/* sparse neighborhoods keep the nearest core offsets, but beyond those,
+   only take offsets on a grid dilation pixels apart. the same number of
+   neighbors then spans a much larger area, to pick up larger structures
+   at the same cost. the passes magic makes are sparse, except for the last
+   dense_passes of them (the last one visits every pixel). 0 disables them. */
+void
+resynth_parameters_sparse(resynth_parameters_t parameters, int core, int dilation, int dense_passes);
+
+/* spends fewer random tries on pixels whose neighbors already suggest
+   a better match than usual, based on running statistics of the matches
+   picked so far. pixels without any such suggestions still get all of them.
+   much faster, at a small cost in quality. off by default. */
+void
+resynth_parameters_adaptive_tries(resynth_parameters_t parameters, bool adaptive);
+
+/* Tiled synthesis: outputs larger than tile_size are split into tiles that
+   are synthesized concurrently, then the bands within overlap pixels of each
+   tile edge are resynthesized serially to hide the seams.
+   this trades coherence across tiles for speed; 0 disables tiling. */
+void
+resynth_parameters_tiles(resynth_parameters_t parameters, int tile_size, int overlap);
+
+/* worker threads for tiled synthesis; 0 uses as many as the executor has. */
+void
+resynth_parameters_threads(resynth_parameters_t parameters, int threads);
+
+/* all of resynth's parallel work is submitted to this executor (copied).
+   NULL selects the default, a pool of threads shared by the whole process,
+   which grows as needed up to the largest number of threads asked for. */
+void
+resynth_parameters_executor(resynth_parameters_t parameters, const resynth_executor_t* executor);
+
+/* while running, save a checkpoint to path every so many seconds,
+   for resynth_resume to continue from. only untiled per-pixel runs
+   are checkpointed. a NULL path or 0 seconds disables checkpoints. */
+void
+resynth_parameters_checkpoint(resynth_parameters_t parameters, const char* path, double seconds);
+
+/* magic already revisits magic/256 of the pixels at random, then that share
+   of those, and so on. the worst strategy then keeps revisiting the pixels
+   with the worst matches and their neighbors, an eighth of the image
+   at a time, until every pixel's energy is at most target or passes
+   have been made. the default is the magic strategy, with a target of 0
+   and 8 passes. */
+void
+resynth_parameters_polish(resynth_parameters_t parameters, resynth_polish_t polish, double target, int passes);
+
+/* the pixel engine has kernels specialized for 3 or 4 channels with 29 or
+   45 neighbors, which are used automatically. this forces the generic one,
+   which gives the same output, for comparison. */
+void
+resynth_parameters_generic_kernel(resynth_parameters_t parameters, bool generic);
+
+/* image quilting stitches patch_size squares of the corpus together along
+   minimum-error cuts through their overlap. it is much faster than the pixel
+   engine and suits stochastic textures; tries sets the candidates per patch. */
+void
+resynth_parameters_engine(resynth_parameters_t parameters, resynth_engine_t engine);
+
+void
+resynth_parameters_patch(resynth_parameters_t parameters, int patch_size, int overlap);
+
 
 /* Processing and Results */ 
 resynth_result_t 
 resynth_run(resynth_state_t state, resynth_parameters_t parameters);
 
+/* starts resynth_run as a task on the parameters' executor, and returns
+   right away. parameters may be changed or freed meanwhile, but the state
+   must be left alone until resynth_task_wait, which returns the result
+   and frees the task. every task must be waited on exactly once. */
+resynth_task_t
+resynth_run_async(resynth_state_t state, resynth_parameters_t parameters);
+
+/* whether the run has finished, so resynth_task_wait won't block. */
+bool
+resynth_task_done(resynth_task_t task);
+
+resynth_result_t
+resynth_task_wait(resynth_task_t task);
+
+/* makes a coarse preview first, at a fraction of the output size and
+   scaled up, then keeps refining it until the given number of seconds
+   have passed or it stops getting better. progress, if not NULL, is called
+   with the preview and then the best result so far after every step;
+   that result is only valid during the call. the final result holds the
+   best image that was measured and its energy, which is only negative if
+   there was no time left to measure even the preview. scaling the preview
+   up takes time in proportion to the output size, so with very large
+   outputs it may come after a very short deadline. runs untiled, per pixel. */
+resynth_result_t
+resynth_run_anytime(resynth_state_t state, resynth_parameters_t parameters, double seconds, resynth_progress_t progress, void* user);
+
+/* picks neighbors, tries and magic by timing short trial syntheses
+   from a crop of the corpus: the cheapest setting whose energy is at most
+   target_energy wins, or the best one if none get there (then this returns
+   false). the choice is applied to parameters and, if choice isn't NULL,
+   reported there so it can be cached. */
+bool
+resynth_autotune(resynth_state_t state, resynth_parameters_t parameters, double target_energy, resynth_tuning_t* choice);
+
+/* continues an interrupted run from its last checkpoint. the state must have
+   been created from the same corpus at the same size, and the parameters
+   must match; the output is the same as if the run had never stopped.
+   the result is invalid if the checkpoint can't be used. */
+resynth_result_t
+resynth_resume(resynth_state_t state, resynth_parameters_t parameters, const char* path);
+
+/* Sharded tiles: the tiles of a tiled run can be synthesized separately,
+   in any order, e.g. by several processes writing into shared memory,
+   and the seams between them filled in afterwards, for the same output
+   as resynth_run. the count is 0 when the run wouldn't be tiled. */
+size_t
+resynth_tile_count(resynth_state_t state, resynth_parameters_t parameters);
+
+/* synthesizes tile index into its place in pixels (width * height * channels
+   at the state's output size) and sources (width * height pairs of x, y
+   corpus coordinates, as for resynth_state_warm_start; may be NULL), without
+   touching the rest of them. returns false if there's no such tile. */
+bool
+resynth_tile_run(resynth_state_t state, resynth_parameters_t parameters, size_t index, uint8_t* pixels, int32_t* sources);
+
+/* fills in the seams between the tiles in pixels and sources, which must
+   have every tile in place, and returns the result like resynth_run.
+   without sources, the seams are filled in less coherently. */
+resynth_result_t
+resynth_tile_seams(resynth_state_t state, resynth_parameters_t parameters, const uint8_t* pixels, const int32_t* sources);
+
+/* the name of the kernel a run with these parameters would use:
+   "generic", or e.g. "c3n29" for 3 channels and 29 neighbors. */
+const char*
+resynth_kernel_name(resynth_state_t state, resynth_parameters_t parameters);
+
+/* changes whenever the same state and parameters give a different output. */
+int
+resynth_version(void);
+
+/* a hash of everything a run's output depends on: the corpus, the output
+   size, any warm start, the parameters (the seed included) and the version,
+   but not threads, the executor or checkpoints. equal hashes mean equal
+   outputs, so they can key a cache of them, as long as the seed was chosen
+   on purpose (the default one is the time). */
+uint64_t
+resynth_hash(resynth_state_t state, resynth_parameters_t parameters);
+
 bool 
 resynth_result_valid(resynth_result_t result);
 
@@ -82,6 +319,25 @@ resynth_result_pixels(resynth_result_t result);
 float* 
 resynth_result_pixelsf(resynth_result_t result);
 
+/* how poorly the pixels match their neighborhoods, between 0 and 1,
+   or negative if it wasn't measured. */
+double
+resynth_result_energy(resynth_result_t result);
+
+/* measures the energy of a result of resynth_run (or the like) from state,
+   which must not have been run again since, and stores it in the result.
+   if error_map isn't NULL, it receives each pixel's own energy
+   (width * height floats). parameters should match the run's, since the
+   energy depends on neighbors and outlier sensitivity. returns a negative
+   value if the result can't be measured (e.g. Wang tiles). */
+double
+resynth_result_measure(resynth_result_t result, resynth_state_t state, resynth_parameters_t parameters, float* error_map);
+
+/* the corpus coordinates each pixel was copied from, as x, y pairs,
+   or -1 for none. NULL if the result has no sources (e.g. Wang tiles). */
+int32_t*
+resynth_result_sources(resynth_result_t result);
+
 size_t
 resynth_result_width(resynth_result_t result);
 
@@ -91,6 +347,79 @@ resynth_result_height(resynth_result_t result);
 size_t
 resynth_result_channels(resynth_result_t result);
 
+/* Wang Tiles */
+/* synthesizes colors^4 tiles of tile_size (colors per edge is at most 4)
+   whose edges match wherever their colors do. edge strips are 2 * overlap
+   (see resynth_parameters_tiles) pixels thick. this is the expensive part,
+   and only needs to happen once per corpus. */
+resynth_wang_t
+resynth_wang_create(resynth_state_t state, resynth_parameters_t parameters, int tile_size, int colors);
+
+/* lays tiles out over width * height pixels, picking each one by hashing
+   the seed and its position. a size of 0 uses the state's output size.
+   the output wraps seamlessly if the parameters did and the size is
+   a multiple of the tile size. the result owns its pixels. */
+resynth_result_t
+resynth_wang_assemble(resynth_wang_t wang, size_t width, size_t height, unsigned long seed);
+
+/* copies the width * height window at (x, y) of an endless, non-repeating
+   texture laid out from the tiles into pixels (width * height * channels).
+   windows only depend on the seed and their coordinates, so windows requested
+   separately always line up, and the cost is proportional to their area. */
+void
+resynth_wang_window(resynth_wang_t wang, unsigned long seed, int64_t x, int64_t y, size_t width, size_t height, uint8_t* pixels);
+
+size_t
+resynth_wang_channels(resynth_wang_t wang);
+
+size_t
+resynth_wang_tile_count(resynth_wang_t wang);
+
+uint8_t*
+resynth_wang_tile_pixels(resynth_wang_t wang, size_t index);
+
+/* Sequences */
+/* synthesizes the frames of an animation one at a time from state, which
+   belongs to the sequence until it's freed. the first frame is an ordinary
+   run. every later one starts from the previous frame's source map, moved
+   along a displacement field, whose sources are the first candidates of
+   their pixels, and only corrects it in a single warm-started pass (untiled,
+   per pixel, with adaptive tries), so it costs a fraction of a fresh run
+   and flickers much less. each frame's seed is the parameters' plus its number. */
+resynth_sequence_t
+resynth_sequence_create(resynth_state_t state, resynth_parameters_t parameters);
+
+/* synthesizes the next frame. displacement holds width * height pairs of
+   dx, dy at the state's output size, or is NULL for none: pixel (x, y)
+   continues what was at (x - dx, y - dy) in the previous frame (rounded,
+   and wrapped like the output). pixels moving in from past an edge that
+   doesn't wrap are synthesized afresh. the result is like resynth_run's. */
+resynth_result_t
+resynth_sequence_next(resynth_sequence_t sequence, const float* displacement);
+
+/* Tracing */
+/* phases of the work (decoding, setting up, every pass, tile and so on)
+   are reported to the hook as they begin and end, on the thread doing them,
+   for the whole process. they nest properly per thread. the name is only
+   valid during the call, and the hook must not report phases itself.
+   NULL removes the hook. */
+void
+resynth_set_phase_hook(resynth_phase_hook_t hook, void* user);
+
+/* reports a phase of the application's own, e.g. encoding the output,
+   to the hook and the trace alongside resynth's. */
+void
+resynth_phase(const char* name, bool begin);
+
+/* writes every phase to path as Chrome trace events (JSON for
+   chrome://tracing or Perfetto), with a track for every thread,
+   until resynth_trace_stop. returns false if the file can't be opened. */
+bool
+resynth_trace_start(const char* path);
+
+void
+resynth_trace_stop(void);
+
 /* Memory Management */ 
 void
 resynth_free_state(resynth_state_t state);
@@ -98,6 +427,12 @@ resynth_free_state(resynth_state_t state);
 void
 resynth_free_parameters(resynth_parameters_t parameters);
 
+void
+resynth_free_wang(resynth_wang_t wang);
+
+void
+resynth_free_sequence(resynth_sequence_t sequence);
+
 void
 resynth_free_result(resynth_result_t result);
 